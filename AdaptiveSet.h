@@ -0,0 +1,150 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <functional>
+//wraps a container with (minChunkSize,maxChunkSize) constructor and setChunkSizes(),
+//times every n-th operation and tunes the chunk size by hill climbing:
+//after each epoch the chunk size is doubled or halved, the direction is reversed when the sampled latency got worse;
+//the containers adapt their nodes lazily, on the next split or merge
+template<typename Value,typename Set>
+class AdaptiveSet
+{
+public:
+    class Iterator;
+    AdaptiveSet(size_t smallestMaxChunkSize,size_t largestMaxChunkSize,size_t epochLength=1<<16);
+    AdaptiveSet(const AdaptiveSet&);
+    void insert(const Value&);
+    void erase(const Value&);
+    //reads only count and time themselves, with atomics, so const calls can run concurrently with each other;
+    //epochs are finished and the chunk size is changed by writes, which need exclusive access anyway
+    bool contains(const Value&) const;
+    void enumerate(const std::function<void(const Value&)>&) const;
+    size_t getMaxChunkSize() const;
+private:
+    static const size_t samplingInterval=64;//operations
+    size_t smallestMaxChunkSize_,largestMaxChunkSize_;
+    size_t epochLength_;//operations
+    size_t maxChunkSize_;
+    Set set_;
+    mutable std::atomic<size_t> readCount_,readSampleCount_;
+    mutable std::atomic<long long> sampledReadNanoseconds_;
+    size_t writeCount_=0,writeSampleCount_=0;
+    double sampledWriteSeconds_=0;
+    double previousLatency_=0,previousWriteShare_=0;
+    bool growing_=true;
+    template<typename Operation>
+    void measureWrite(const Operation&);
+    void finishEpoch();
+    void applyChunkSize(size_t maxChunkSize);
+};
+///////////////////////////////////////////////////////////////////////////////
+template<typename Value,typename Set>
+AdaptiveSet<Value,Set>::AdaptiveSet(size_t smallestMaxChunkSize,size_t largestMaxChunkSize,size_t epochLength)
+    :smallestMaxChunkSize_(smallestMaxChunkSize)
+    ,largestMaxChunkSize_(largestMaxChunkSize)
+    ,epochLength_(epochLength)
+    ,maxChunkSize_(static_cast<size_t>(std::sqrt(double(smallestMaxChunkSize)*largestMaxChunkSize)))
+    ,set_(maxChunkSize_/2,maxChunkSize_)
+    ,readCount_(0)
+    ,readSampleCount_(0)
+    ,sampledReadNanoseconds_(0)
+{}
+template<typename Value,typename Set>
+AdaptiveSet<Value,Set>::AdaptiveSet(const AdaptiveSet &other)
+    :smallestMaxChunkSize_(other.smallestMaxChunkSize_)
+    ,largestMaxChunkSize_(other.largestMaxChunkSize_)
+    ,epochLength_(other.epochLength_)
+    ,maxChunkSize_(other.maxChunkSize_)
+    ,set_(other.set_)
+    ,readCount_(other.readCount_.load())
+    ,readSampleCount_(other.readSampleCount_.load())
+    ,sampledReadNanoseconds_(other.sampledReadNanoseconds_.load())
+    ,writeCount_(other.writeCount_)
+    ,writeSampleCount_(other.writeSampleCount_)
+    ,sampledWriteSeconds_(other.sampledWriteSeconds_)
+    ,previousLatency_(other.previousLatency_)
+    ,previousWriteShare_(other.previousWriteShare_)
+    ,growing_(other.growing_)
+{}
+template<typename Value,typename Set>
+void AdaptiveSet<Value,Set>::insert(const Value &value)
+{
+    measureWrite([&]{set_.insert(value);});
+}
+template<typename Value,typename Set>
+void AdaptiveSet<Value,Set>::erase(const Value &value)
+{
+    measureWrite([&]{set_.erase(value);});
+}
+template<typename Value,typename Set>
+bool AdaptiveSet<Value,Set>::contains(const Value &value) const
+{
+    if((readCount_.fetch_add(1,std::memory_order_relaxed)+1)%samplingInterval!=0)
+        return set_.contains(value);
+    const auto start=std::chrono::steady_clock::now();
+    const auto result=set_.contains(value);
+    sampledReadNanoseconds_.fetch_add(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-start).count(),
+        std::memory_order_relaxed);
+    readSampleCount_.fetch_add(1,std::memory_order_relaxed);
+    return result;
+}
+template<typename Value,typename Set>
+void AdaptiveSet<Value,Set>::enumerate(const std::function<void(const Value&)> &processor) const
+{
+    set_.enumerate(processor);
+}
+template<typename Value,typename Set>
+size_t AdaptiveSet<Value,Set>::getMaxChunkSize() const
+{
+    return maxChunkSize_;
+}
+template<typename Value,typename Set>
+template<typename Operation>
+void AdaptiveSet<Value,Set>::measureWrite(const Operation &operation)
+{
+    if(++writeCount_%samplingInterval!=0)
+        operation();
+    else
+    {
+        const auto start=std::chrono::steady_clock::now();
+        operation();
+        sampledWriteSeconds_+=std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+        ++writeSampleCount_;
+    }
+    if(writeCount_+readCount_.load(std::memory_order_relaxed)>=epochLength_)
+        finishEpoch();
+}
+template<typename Value,typename Set>
+void AdaptiveSet<Value,Set>::finishEpoch()
+{
+    const auto readCount=readCount_.exchange(0,std::memory_order_relaxed);
+    const auto sampleCount=writeSampleCount_+readSampleCount_.exchange(0,std::memory_order_relaxed);
+    const auto sampledSeconds=sampledWriteSeconds_+sampledReadNanoseconds_.exchange(0,std::memory_order_relaxed)/1e9;
+    const auto latency=(sampleCount>0?sampledSeconds/sampleCount:0);
+    const auto writeShare=double(writeCount_)/(writeCount_+readCount);
+    if(previousLatency_==0 || std::abs(writeShare-previousWriteShare_)>0.25)
+    {//the workload is new, previous measurements are not comparable: start from what the mix suggests
+        growing_=(writeShare<0.5);//reads prefer shallow trees, writes prefer short shifts
+    }
+    else if(latency>previousLatency_)
+        growing_=!growing_;
+    previousLatency_=latency;
+    previousWriteShare_=writeShare;
+    writeCount_=writeSampleCount_=0;
+    sampledWriteSeconds_=0;
+    if(writeShare<0.01)
+        return;//without writes nodes are not rebuilt, so the chunk size has no effect to measure
+    if(growing_)
+        applyChunkSize(std::min(maxChunkSize_*2,largestMaxChunkSize_));
+    else
+        applyChunkSize(std::max(maxChunkSize_/2,smallestMaxChunkSize_));
+}
+template<typename Value,typename Set>
+void AdaptiveSet<Value,Set>::applyChunkSize(size_t maxChunkSize)
+{
+    maxChunkSize_=maxChunkSize;
+    set_.setChunkSizes(maxChunkSize/2,maxChunkSize);
+}
@@ -1,86 +1,567 @@
 #pragma once
 #include <algorithm>
 #include <functional>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <utility>
 #include <variant>
 #include <vector>
-template<typename Value>
+#include "NodeOwnership.h"
+#include "SortedSequences.h"
+#include "Statistics.h"
+template<typename Value,typename Allocator=std::allocator<Value>,typename Statistics=NoStatistics,typename NodeOwnership=OwnedNodes>
 class BTree
 {
 public:
     class Iterator;
-    BTree(size_t minChunkSize,size_t maxChunkSize);
+    //nodes are rebalanced only when they get below minChunkSize-underflowSlack, which stops split/merge thrashing
+    //under insert/erase churn; with deferredRebalancing only empty nodes are merged, the rest waits for compact()
+    BTree(size_t minChunkSize,size_t maxChunkSize,size_t underflowSlack=0);
+    static const size_t deferredRebalancing=size_t(-1);
     void insert(const Value&);
     void erase(const Value&);
+    //the outermost leaves are trimmed in place and values of the tree in [from,to) are cut out with two splits,
+    //the rest is joined back, so subtrees in between are freed whole and only the nodes along both boundaries
+    //are rebalanced
+    size_t eraseRange(const Value &from,const Value &to);//returns the number of erased values
+    size_t eraseIf(const std::function<bool(const Value&)>&);//the tree is rebuilt from the values left, if any are erased
     bool contains(const Value&) const;
     void enumerate(const std::function<void(const Value&)>&) const;
+    //[from,to), children left of from are skipped and the walk stops at to
+    void enumerateRange(const Value &from,const Value &to,const std::function<void(const Value&)>&) const;
+    //the outermost leaves are kept at the root, so these are O(1) and a leaf is taken from the tree
+    //only once all values of the previous one are popped; all of them throw on an empty tree
+    const Value &min() const;
+    const Value &max() const;
+    Value popMin();
+    Value popMax();
+    void setChunkSizes(size_t minChunkSize,size_t maxChunkSize);//existing nodes follow on their next split or merge
+    void compact();//rebuilds the tree with all nodes between minChunkSize and maxChunkSize
+    //results use chunk sizes of the first tree and are built bottom-up from sorted values; for intersection
+    //and for difference with a first tree not taller than the second one, values of the lower tree are looked up
+    //in the other one guided by its separators, so subtrees holding none of them are never visited
+    static BTree setUnion(const BTree&,const BTree&);
+    static BTree setIntersection(const BTree&,const BTree&);
+    static BTree setDifference(const BTree&,const BTree&);//values of the first tree absent in the second one
+    void merge(const BTree&);
+    static std::pair<BTree,BTree> split(BTree&&,const Value&);//values<value go to the first tree, the rest to the second one
+    static BTree join(BTree &&left,BTree &&right);//all values of the left tree must be less than values of the right one
+    //a copy; with SharedNodes only the root and the outermost leaves are copied, the rest is shared until written to,
+    //so the copy can be read from other threads while this tree keeps changing (taking it must not race with writes)
+    BTree snapshot() const;
+    LeafFill statistics() const;//counters are process-wide, see Statistics::getCounters()
 private:
+    using Values=std::vector<Value,Allocator>;
+    struct Node;
+    using NodePointer=typename NodeOwnership::template Pointer<Node,typename std::allocator_traits<Allocator>::template rebind_alloc<Node>>;
+    using Nodes=std::vector<NodePointer,typename std::allocator_traits<Allocator>::template rebind_alloc<NodePointer>>;
     struct Node
     {
-        std::vector<Value> values_;
-        std::vector<Node> children_;
+        Values values_;
+        Nodes children_;
     };
     size_t minChunkSize_,maxChunkSize_;
+    size_t underflowSlack_;
     Node root_;
+    //the outermost leaves, out of the tree: first_ is in descending order, so both ends are popped from the back;
+    //first_ is empty only in an empty container, last_ only when the tree between them is empty too
+    Values first_,last_;
+    void insertIntoTree(const Value&);
+    void eraseFromTree(const Value&);
     void increaseDepthIfNeeded();
     void decreaseDepthIfNeeded();
+    size_t getUnderflowChunkSize() const;
+    void refillFirst();//after first_ got empty
+    void refillLast();//after last_ got empty
+    void spillFirst();//after first_ got overfull
+    void spillLast();//after last_ got overfull
+    void attachEnds();//the tree holds all values afterwards, for operations on the whole tree
+    void detachEnds();
+    void rebuild(Values&&);
+    size_t getValueCount() const;
+    size_t eraseRangeFromEnds(const Value &from,const Value &to);//first_ and last_ are not refilled
+    void collect(const Value &from,const Value &to,Values&) const;//appends values from [from,to]
+    void intersect(const Values &sorted,Values &found) const;//appends sorted values which are in this tree
     static void insert(const Value&,Node&,size_t maxChunkSize);
-    static void erase(const Value&,Node&,size_t minChunkSize,size_t maxChunkSize);
+    static void erase(const Value&,Node&,size_t minChunkSize,size_t maxChunkSize,size_t underflowChunkSize);
+    static void insertIntoLeaf(Values&,size_t index,const Value&);//unless the value is at the index already
+    static void eraseFromLeaf(Values&,size_t index,const Value&);//if the value is at the index
+    static size_t findIndexInFirst(const Values &first,const Value&);//first_ is descending, returns first element<=value
+    //append values of the outermost leaf and the separator next to it in the order of first_ or last_
+    static void detachFirstLeaf(Node&,Values&,size_t minChunkSize,size_t maxChunkSize,size_t underflowChunkSize);
+    static void detachLastLeaf(Node&,Values&,size_t minChunkSize,size_t maxChunkSize,size_t underflowChunkSize);
+    //sorted values beyond all values of the node go to its outermost leaf
+    static void insertFirst(Values&&,Node&,size_t maxChunkSize);
+    static void insertLast(Values&&,Node&,size_t maxChunkSize);
     static bool contains(const Node&,const Value&);
     static void enumerate(const Node&,const std::function<void(const Value&)>&);
+    static bool enumerateRange(const Node&,const Value &from,const Value &to,const std::function<void(const Value&)>&);//false once to is reached
+    void addLeaves(const Node&,LeafFill&) const;
     static void splitChild(Node&,size_t childIndex);
     static void mergeChild(Node&,size_t childIndex);
-    static size_t findIndexForValue(const std::vector<Value>&,const Value&);//returns first element>=value
+    static bool borrowFromSibling(Node&,size_t childIndex,size_t minChunkSize);//returns false if siblings have nothing to spare
+    static size_t findIndexForValue(const Values&,const Value&);//returns first element>=value
+    static size_t getSize(const NodePointer&);//reads through a const pointer, so a shared node isn't copied
     static const Value &getMinValue(const Node&);
-    static void eraseFromChildWithRebalancing(const Value&,Node&,size_t childIndex,size_t minChunkSize,size_t maxChunkSize);
+    static const Value &getMaxValue(const Node&);
+    static void collect(const Node&,const Value &from,const Value &to,Values&);//appends values from [from,to]
+    static Values collect(const BTree&);
+    static void intersect(
+        const Node&,
+        typename Values::const_iterator begin,
+        typename Values::const_iterator end,
+        Values &found);
+    static Node buildFromSorted(Values,size_t minChunkSize,size_t maxChunkSize);
+    static void buildLevel(Values&,Nodes&,size_t minChunkSize,size_t maxChunkSize);
+    static void eraseFromChildWithRebalancing(
+        const Value&,
+        Node&,
+        size_t childIndex,
+        size_t minChunkSize,
+        size_t maxChunkSize,
+        size_t underflowChunkSize);
+    static void rebalanceChild(Node&,size_t childIndex,size_t minChunkSize,size_t maxChunkSize,size_t underflowChunkSize);
+    static size_t getHeight(const Node&);
+    static size_t getValueCount(const Node&);
+    static void split(Node&&,const Value&,BTree &left,BTree &right);
+    static BTree join(BTree &&left,Value &&separator,BTree &&right);
+    static BTree joinTrees(BTree &&left,BTree &&right);//the smallest value of the right tree becomes the separator
+    static void attachRight(Node&,size_t heightDifference,Value &&separator,Node &&right,size_t minChunkSize,size_t maxChunkSize);
+    static void attachLeft(Node&,size_t heightDifference,Node &&left,Value &&separator,size_t minChunkSize,size_t maxChunkSize);
 };
 ///////////////////////////////////////////////////////////////////////////////
-template<typename Value>
-BTree<Value>::BTree(size_t minChunkSize,size_t maxChunkSize)
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+BTree<Value,Allocator,Statistics,NodeOwnership>::BTree(size_t minChunkSize,size_t maxChunkSize,size_t underflowSlack)
     :minChunkSize_(minChunkSize)
     ,maxChunkSize_(maxChunkSize)
+    ,underflowSlack_(underflowSlack)
 {}
-template<typename Value>
-void BTree<Value>::insert(const Value &value)
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+void BTree<Value,Allocator,Statistics,NodeOwnership>::insert(const Value &value)
 {
-    insert(value,root_,maxChunkSize_);
-    increaseDepthIfNeeded();
+    Statistics::add(Counter::insertion);
+    if(first_.empty() || !(first_.front()<value))
+    {
+        insertIntoLeaf(first_,findIndexInFirst(first_,value),value);
+        if(first_.size()>maxChunkSize_)
+            spillFirst();
+    }
+    else if(last_.empty() || !(value<last_.front()))
+    {//last_ is empty only when the tree is
+        insertIntoLeaf(last_,findIndexForValue(last_,value),value);
+        if(last_.size()>maxChunkSize_)
+            spillLast();
+    }
+    else
+        insertIntoTree(value);
 }
-template<typename Value>
-void BTree<Value>::erase(const Value &value)
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+void BTree<Value,Allocator,Statistics,NodeOwnership>::erase(const Value &value)
 {
-    erase(value,root_,minChunkSize_,maxChunkSize_);
-    decreaseDepthIfNeeded();
+    if(!first_.empty() && !(first_.front()<value))
+    {
+        eraseFromLeaf(first_,findIndexInFirst(first_,value),value);
+        if(first_.empty())
+            refillFirst();
+    }
+    else if(!last_.empty() && !(value<last_.front()))
+    {
+        eraseFromLeaf(last_,findIndexForValue(last_,value),value);
+        if(last_.empty())
+            refillLast();
+    }
+    else
+        eraseFromTree(value);
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+size_t BTree<Value,Allocator,Statistics,NodeOwnership>::eraseRange(const Value &from,const Value &to)
+{
+    if(!(from<to))
+        return 0;
+    const auto lowerBound=from,upperBound=to;//the arguments may refer to values of this tree
+    auto count=eraseRangeFromEnds(lowerBound,upperBound);
+    if(!root_.values_.empty())
+    {
+        BTree lower(minChunkSize_,maxChunkSize_,underflowSlack_),rest(minChunkSize_,maxChunkSize_,underflowSlack_);
+        BTree middle(minChunkSize_,maxChunkSize_,underflowSlack_),upper(minChunkSize_,maxChunkSize_,underflowSlack_);
+        split(std::move(root_),lowerBound,lower,rest);
+        split(std::move(rest.root_),upperBound,middle,upper);
+        count+=getValueCount(middle.root_);
+        root_=std::move(joinTrees(std::move(lower),std::move(upper)).root_);
+    }
+    if(first_.empty())
+        refillFirst();
+    if(last_.empty())
+        refillLast();
+    return count;
 }
-template<typename Value>
-bool BTree<Value>::contains(const Value &value) const
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+size_t BTree<Value,Allocator,Statistics,NodeOwnership>::eraseIf(const std::function<bool(const Value&)> &predicate)
 {
+    auto values=collect(*this);
+    const auto count=values.size();
+    values.erase(std::remove_if(values.begin(),values.end(),predicate),values.end());
+    const auto erasedCount=count-values.size();
+    if(erasedCount>0)
+        rebuild(std::move(values));
+    return erasedCount;
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+bool BTree<Value,Allocator,Statistics,NodeOwnership>::contains(const Value &value) const
+{
+    Statistics::add(Counter::lookup);
+    if(!first_.empty() && !(first_.front()<value))
+    {
+        Statistics::add(Counter::visitedNode);
+        const auto index=findIndexInFirst(first_,value);
+        return index<first_.size() && first_[index]==value;
+    }
+    if(!last_.empty() && !(value<last_.front()))
+    {
+        Statistics::add(Counter::visitedNode);
+        const auto index=findIndexForValue(last_,value);
+        return index<last_.size() && last_[index]==value;
+    }
     return contains(root_,value);
 }
-template<typename Value>
-void BTree<Value>::enumerate(const std::function<void(const Value&)> &processor) const
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+void BTree<Value,Allocator,Statistics,NodeOwnership>::enumerate(const std::function<void(const Value&)> &processor) const
 {
+    for(auto value=first_.rbegin();value!=first_.rend();++value)
+        processor(*value);
     enumerate(root_,processor);
+    for(const auto &value:last_)
+        processor(value);
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+void BTree<Value,Allocator,Statistics,NodeOwnership>::enumerateRange(
+    const Value &from,
+    const Value &to,
+    const std::function<void(const Value&)> &processor) const
+{
+    for(auto value=first_.rbegin();value!=first_.rend() && *value<to;++value)
+        if(!(*value<from))
+            processor(*value);
+    if(!root_.values_.empty() && !enumerateRange(root_,from,to,processor))
+        return;
+    for(auto value=last_.begin()+findIndexForValue(last_,from);value!=last_.end() && *value<to;++value)
+        processor(*value);
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+const Value &BTree<Value,Allocator,Statistics,NodeOwnership>::min() const
+{
+    if(first_.empty())
+        throw std::logic_error("the tree is empty");
+    return first_.back();
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+const Value &BTree<Value,Allocator,Statistics,NodeOwnership>::max() const
+{
+    if(first_.empty())
+        throw std::logic_error("the tree is empty");
+    return (last_.empty()?first_.front():last_.back());
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+Value BTree<Value,Allocator,Statistics,NodeOwnership>::popMin()
+{
+    if(first_.empty())
+        throw std::logic_error("the tree is empty");
+    auto value=std::move(first_.back());
+    first_.pop_back();
+    if(first_.empty())
+        refillFirst();
+    return value;
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+Value BTree<Value,Allocator,Statistics,NodeOwnership>::popMax()
+{
+    if(first_.empty())
+        throw std::logic_error("the tree is empty");
+    if(last_.empty())
+    {//all values are in first_, which is no longer than a leaf
+        auto value=std::move(first_.front());
+        first_.erase(first_.begin());
+        return value;
+    }
+    auto value=std::move(last_.back());
+    last_.pop_back();
+    if(last_.empty())
+        refillLast();
+    return value;
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+void BTree<Value,Allocator,Statistics,NodeOwnership>::setChunkSizes(size_t minChunkSize,size_t maxChunkSize)
+{
+    minChunkSize_=minChunkSize;
+    maxChunkSize_=maxChunkSize;
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+void BTree<Value,Allocator,Statistics,NodeOwnership>::compact()
+{
+    rebuild(collect(*this));
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+BTree<Value,Allocator,Statistics,NodeOwnership> BTree<Value,Allocator,Statistics,NodeOwnership>::setUnion(const BTree &first,const BTree &second)
+{
+    BTree result(first.minChunkSize_,first.maxChunkSize_,first.underflowSlack_);
+    result.rebuild(uniteSorted(collect(first),collect(second)));
+    return result;
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+BTree<Value,Allocator,Statistics,NodeOwnership> BTree<Value,Allocator,Statistics,NodeOwnership>::setIntersection(const BTree &first,const BTree &second)
+{
+    BTree result(first.minChunkSize_,first.maxChunkSize_,first.underflowSlack_);
+    if(first.first_.empty() || second.first_.empty())
+        return result;
+    const bool isFirstLower=getHeight(first.root_)<=getHeight(second.root_);
+    const auto &lower=isFirstLower?first:second;
+    const auto &higher=isFirstLower?second:first;
+    if(higher.max()<lower.min() || lower.max()<higher.min())
+        return result;//the ranges don't overlap
+    Values values,found;
+    lower.collect(higher.min(),higher.max(),values);
+    higher.intersect(values,found);
+    result.rebuild(std::move(found));
+    return result;
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+BTree<Value,Allocator,Statistics,NodeOwnership> BTree<Value,Allocator,Statistics,NodeOwnership>::setDifference(const BTree &first,const BTree &second)
+{
+    BTree result(first.minChunkSize_,first.maxChunkSize_,first.underflowSlack_);
+    if(first.first_.empty())
+        return result;
+    if(!second.first_.empty() && getHeight(first.root_)<=getHeight(second.root_))
+    {
+        auto values=collect(first);
+        Values found;
+        second.intersect(values,found);
+        result.rebuild(subtractSorted(values,found));
+        return result;
+    }
+    Values secondValues;//only the part which can affect the result
+    second.collect(first.min(),first.max(),secondValues);
+    result.rebuild(subtractSorted(collect(first),secondValues));
+    return result;
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+void BTree<Value,Allocator,Statistics,NodeOwnership>::merge(const BTree &other)
+{
+    rebuild(uniteSorted(collect(*this),collect(other)));
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+std::pair<BTree<Value,Allocator,Statistics,NodeOwnership>,BTree<Value,Allocator,Statistics,NodeOwnership>> BTree<Value,Allocator,Statistics,NodeOwnership>::split(BTree &&tree,const Value &value)
+{
+    BTree left(tree.minChunkSize_,tree.maxChunkSize_,tree.underflowSlack_);
+    BTree right(tree.minChunkSize_,tree.maxChunkSize_,tree.underflowSlack_);
+    tree.attachEnds();
+    split(std::move(tree.root_),value,left,right);
+    tree.root_=Node();
+    left.detachEnds();
+    right.detachEnds();
+    return {std::move(left),std::move(right)};
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+BTree<Value,Allocator,Statistics,NodeOwnership> BTree<Value,Allocator,Statistics,NodeOwnership>::join(BTree &&left,BTree &&right)
+{
+    if(left.first_.empty())
+        return std::move(right);
+    if(right.first_.empty())
+        return std::move(left);
+    if(!(left.max()<right.min()))
+        throw std::logic_error("joined trees overlap");
+    left.attachEnds();
+    right.attachEnds();
+    auto result=joinTrees(std::move(left),std::move(right));
+    result.detachEnds();
+    return result;
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+BTree<Value,Allocator,Statistics,NodeOwnership> BTree<Value,Allocator,Statistics,NodeOwnership>::snapshot() const
+{
+    return *this;
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+LeafFill BTree<Value,Allocator,Statistics,NodeOwnership>::statistics() const
+{
+    LeafFill fill;
+    if(!first_.empty())
+        fill.addLeaf(first_.size(),maxChunkSize_);
+    addLeaves(root_,fill);
+    if(!last_.empty())
+        fill.addLeaf(last_.size(),maxChunkSize_);
+    return fill;
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+void BTree<Value,Allocator,Statistics,NodeOwnership>::insertIntoTree(const Value &value)
+{
+    insert(value,root_,maxChunkSize_);
+    increaseDepthIfNeeded();
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+void BTree<Value,Allocator,Statistics,NodeOwnership>::eraseFromTree(const Value &value)
+{
+    erase(value,root_,minChunkSize_,maxChunkSize_,getUnderflowChunkSize());
+    decreaseDepthIfNeeded();
 }
-template<typename Value>
-void BTree<Value>::increaseDepthIfNeeded()
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+void BTree<Value,Allocator,Statistics,NodeOwnership>::increaseDepthIfNeeded()
 {
     if(root_.values_.size()<=maxChunkSize_)
         return;
+    Statistics::add(Counter::depthIncrease);
     Node newRoot;
     newRoot.children_.push_back(std::move(root_));
     root_=std::move(newRoot);
     splitChild(root_,0);
 }
-template<typename Value>
-void BTree<Value>::decreaseDepthIfNeeded()
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+void BTree<Value,Allocator,Statistics,NodeOwnership>::decreaseDepthIfNeeded()
 {
     if(root_.children_.size()!=1)
         return;
-    auto newRoot=std::move(root_.children_.front());
+    Statistics::add(Counter::depthDecrease);
+    auto newRoot=std::move(*root_.children_.front());
     root_=std::move(newRoot);
 }
-template<typename Value>
-void BTree<Value>::insert(const Value &value,Node &node,size_t maxChunkSize)
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+size_t BTree<Value,Allocator,Statistics,NodeOwnership>::getUnderflowChunkSize() const
+{//nodes are never left empty, so separators can always be replaced from the right child
+    return (underflowSlack_<minChunkSize_?minChunkSize_-underflowSlack_:1);
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+void BTree<Value,Allocator,Statistics,NodeOwnership>::refillFirst()
+{//the next leaf comes from the tree, or last_ is all that is left
+    if(!root_.values_.empty())
+    {
+        detachFirstLeaf(root_,first_,minChunkSize_,maxChunkSize_,getUnderflowChunkSize());
+        decreaseDepthIfNeeded();
+    }
+    else
+    {
+        first_.assign(std::make_move_iterator(last_.rbegin()),std::make_move_iterator(last_.rend()));
+        last_.clear();
+    }
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+void BTree<Value,Allocator,Statistics,NodeOwnership>::refillLast()
+{
+    if(root_.values_.empty())
+        return;
+    detachLastLeaf(root_,last_,minChunkSize_,maxChunkSize_,getUnderflowChunkSize());
+    decreaseDepthIfNeeded();
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+void BTree<Value,Allocator,Statistics,NodeOwnership>::spillFirst()
+{//the larger half becomes the first leaf of the tree, or last_ if there is no tree
+    const auto count=first_.size()/2;
+    Values values(std::make_move_iterator(first_.rend()-count),std::make_move_iterator(first_.rend()));
+    first_.erase(first_.begin(),first_.begin()+count);
+    if(last_.empty())
+        last_=std::move(values);
+    else
+    {
+        insertFirst(std::move(values),root_,maxChunkSize_);
+        increaseDepthIfNeeded();
+    }
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+void BTree<Value,Allocator,Statistics,NodeOwnership>::spillLast()
+{
+    const auto count=last_.size()/2;
+    Values values(std::make_move_iterator(last_.begin()),std::make_move_iterator(last_.begin()+count));
+    last_.erase(last_.begin(),last_.begin()+count);
+    insertLast(std::move(values),root_,maxChunkSize_);
+    increaseDepthIfNeeded();
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+void BTree<Value,Allocator,Statistics,NodeOwnership>::attachEnds()
+{
+    if(!first_.empty())
+    {
+        Values values(std::make_move_iterator(first_.rbegin()),std::make_move_iterator(first_.rend()));
+        first_.clear();
+        insertFirst(std::move(values),root_,maxChunkSize_);
+        increaseDepthIfNeeded();
+    }
+    if(!last_.empty())
+    {
+        insertLast(std::move(last_),root_,maxChunkSize_);
+        last_.clear();
+        increaseDepthIfNeeded();
+    }
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+void BTree<Value,Allocator,Statistics,NodeOwnership>::detachEnds()
+{
+    refillFirst();
+    refillLast();
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+void BTree<Value,Allocator,Statistics,NodeOwnership>::rebuild(Values &&values)
+{
+    first_.clear();
+    last_.clear();
+    root_=buildFromSorted(std::move(values),minChunkSize_,maxChunkSize_);
+    detachEnds();
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+size_t BTree<Value,Allocator,Statistics,NodeOwnership>::getValueCount() const
+{
+    return first_.size()+getValueCount(root_)+last_.size();
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+size_t BTree<Value,Allocator,Statistics,NodeOwnership>::eraseRangeFromEnds(const Value &from,const Value &to)
+{
+    size_t count=0;
+    const auto descending=[](const Value &left,const Value &right){return right<left;};
+    const auto firstEnd=std::upper_bound(first_.begin(),first_.end(),from,descending);
+    const auto firstBegin=std::upper_bound(first_.begin(),firstEnd,to,descending);
+    count+=size_t(firstEnd-firstBegin);
+    first_.erase(firstBegin,firstEnd);
+    const auto lastBegin=std::lower_bound(last_.begin(),last_.end(),from);
+    const auto lastEnd=std::lower_bound(lastBegin,last_.end(),to);
+    count+=size_t(lastEnd-lastBegin);
+    last_.erase(lastBegin,lastEnd);
+    return count;
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+void BTree<Value,Allocator,Statistics,NodeOwnership>::collect(const Value &from,const Value &to,Values &values) const
+{
+    for(auto value=first_.rbegin();value!=first_.rend();++value)
+        if(!(*value<from) && !(to<*value))
+            values.push_back(*value);
+    if(!root_.values_.empty())
+        collect(root_,from,to,values);
+    for(const auto &value:last_)
+        if(!(value<from) && !(to<value))
+            values.push_back(value);
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+void BTree<Value,Allocator,Statistics,NodeOwnership>::intersect(const Values &sorted,Values &found) const
+{
+    auto value=sorted.begin();
+    for(;value!=sorted.end() && !first_.empty() && !(first_.front()<*value);++value)
+    {
+        const auto index=findIndexInFirst(first_,*value);
+        if(index<first_.size() && first_[index]==*value)
+            found.push_back(*value);
+    }
+    const auto treeEnd=last_.empty()?sorted.end():std::lower_bound(value,sorted.end(),last_.front());
+    if(!root_.values_.empty())
+        intersect(root_,value,treeEnd,found);
+    size_t position=0;
+    for(value=treeEnd;value!=sorted.end();++value)
+    {
+        position=gallop(last_,position,*value);
+        if(position==last_.size())
+            break;
+        if(last_[position]==*value)
+            found.push_back(*value);
+    }
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+void BTree<Value,Allocator,Statistics,NodeOwnership>::insert(const Value &value,Node &node,size_t maxChunkSize)
 {
     auto &values=node.values_;
     const auto index=findIndexForValue(values,value);
@@ -88,17 +569,23 @@ void BTree<Value>::insert(const Value &value,Node &node,size_t maxChunkSize)
         return;//the value is already in the container
     if(node.children_.empty())
     {//insert into the sorted array
+        Statistics::add(Counter::movedValue,values.size()-index);
         values.insert(values.begin()+index,value);
     }
     else
     {//insert into one of children
-        insert(value,node.children_[index],maxChunkSize);
-        if(node.children_[index].values_.size()>maxChunkSize)
+        insert(value,*node.children_[index],maxChunkSize);
+        if(getSize(node.children_[index])>maxChunkSize)
             splitChild(node,index);
     }
 }
-template<typename Value>
-void BTree<Value>::erase(const Value &value,Node &node,size_t minChunkSize,size_t maxChunkSize)
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+void BTree<Value,Allocator,Statistics,NodeOwnership>::erase(
+    const Value &value,
+    Node &node,
+    size_t minChunkSize,
+    size_t maxChunkSize,
+    size_t underflowChunkSize)
 {
     auto &values=node.values_;
     if(node.children_.empty())
@@ -112,47 +599,173 @@ void BTree<Value>::erase(const Value &value,Node &node,size_t minChunkSize,size_
         const auto index=findIndexForValue(values,value);
         if(index<values.size() && values[index]==value)
         {//it's a separator, replace it with min value from the right child (and erase it from there)
-            values[index]=getMinValue(node.children_[index+1]);
-            eraseFromChildWithRebalancing(values[index],node,index+1,minChunkSize,maxChunkSize);
+            values[index]=getMinValue(*node.children_[index+1]);
+            eraseFromChildWithRebalancing(values[index],node,index+1,minChunkSize,maxChunkSize,underflowChunkSize);
         }
         else
         {//erase the value from the corresponding child
-            eraseFromChildWithRebalancing(value,node,index,minChunkSize,maxChunkSize);
+            eraseFromChildWithRebalancing(value,node,index,minChunkSize,maxChunkSize,underflowChunkSize);
         }
     }
 }
-template<typename Value>
-bool BTree<Value>::contains(const Node &node,const Value &value)
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+void BTree<Value,Allocator,Statistics,NodeOwnership>::insertIntoLeaf(Values &values,size_t index,const Value &value)
+{
+    if(index<values.size() && values[index]==value)
+        return;//the value is already in the container
+    Statistics::add(Counter::movedValue,values.size()-index);
+    values.insert(values.begin()+index,value);
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+void BTree<Value,Allocator,Statistics,NodeOwnership>::eraseFromLeaf(Values &values,size_t index,const Value &value)
+{
+    if(index<values.size() && values[index]==value)
+        values.erase(values.begin()+index);
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+size_t BTree<Value,Allocator,Statistics,NodeOwnership>::findIndexInFirst(const Values &first,const Value &value)
+{//smallest values sit at the end, so popping and inserting them moves little
+    return size_t(std::lower_bound(first.begin(),first.end(),value,[](const Value &left,const Value &right){return right<left;})-first.begin());
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+void BTree<Value,Allocator,Statistics,NodeOwnership>::detachFirstLeaf(
+    Node &node,
+    Values &values,
+    size_t minChunkSize,
+    size_t maxChunkSize,
+    size_t underflowChunkSize)
+{//no comparisons on the way down; a node left with too few children is rebalanced by its parent
+    if(node.children_.empty())
+    {//the root is the only leaf
+        std::move(node.values_.rbegin(),node.values_.rend(),std::back_inserter(values));
+        node.values_.clear();
+        return;
+    }
+    auto &child=*node.children_.front();
+    if(child.children_.empty())
+    {
+        values.push_back(std::move(node.values_.front()));
+        std::move(child.values_.rbegin(),child.values_.rend(),std::back_inserter(values));
+        node.values_.erase(node.values_.begin());
+        node.children_.erase(node.children_.begin());
+        return;
+    }
+    detachFirstLeaf(child,values,minChunkSize,maxChunkSize,underflowChunkSize);
+    rebalanceChild(node,0,minChunkSize,maxChunkSize,underflowChunkSize);
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+void BTree<Value,Allocator,Statistics,NodeOwnership>::detachLastLeaf(
+    Node &node,
+    Values &values,
+    size_t minChunkSize,
+    size_t maxChunkSize,
+    size_t underflowChunkSize)
+{
+    if(node.children_.empty())
+    {
+        std::move(node.values_.begin(),node.values_.end(),std::back_inserter(values));
+        node.values_.clear();
+        return;
+    }
+    auto &child=*node.children_.back();
+    if(child.children_.empty())
+    {
+        values.push_back(std::move(node.values_.back()));
+        std::move(child.values_.begin(),child.values_.end(),std::back_inserter(values));
+        node.values_.pop_back();
+        node.children_.pop_back();
+        return;
+    }
+    detachLastLeaf(child,values,minChunkSize,maxChunkSize,underflowChunkSize);
+    rebalanceChild(node,node.children_.size()-1,minChunkSize,maxChunkSize,underflowChunkSize);
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+void BTree<Value,Allocator,Statistics,NodeOwnership>::insertFirst(Values &&values,Node &node,size_t maxChunkSize)
+{//an overfull leaf is at most twice as large as allowed, so a single split on each level is enough
+    if(node.children_.empty())
+    {
+        Statistics::add(Counter::movedValue,node.values_.size());
+        node.values_.insert(node.values_.begin(),std::make_move_iterator(values.begin()),std::make_move_iterator(values.end()));
+        return;
+    }
+    insertFirst(std::move(values),*node.children_.front(),maxChunkSize);
+    if(getSize(node.children_.front())>maxChunkSize)
+        splitChild(node,0);
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+void BTree<Value,Allocator,Statistics,NodeOwnership>::insertLast(Values &&values,Node &node,size_t maxChunkSize)
+{
+    if(node.children_.empty())
+    {
+        std::move(values.begin(),values.end(),std::back_inserter(node.values_));
+        return;
+    }
+    insertLast(std::move(values),*node.children_.back(),maxChunkSize);
+    if(getSize(node.children_.back())>maxChunkSize)
+        splitChild(node,node.children_.size()-1);
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+bool BTree<Value,Allocator,Statistics,NodeOwnership>::contains(const Node &node,const Value &value)
 {
+    Statistics::add(Counter::visitedNode);
     const auto &values=node.values_;
     const auto index=findIndexForValue(values,value);
     if(index<values.size() && values[index]==value)
         return true;
     else if(!node.children_.empty())
-        return contains(node.children_[index],value);
+        return contains(*node.children_[index],value);
     else
         return false;
 }
-template<typename Value>
-void BTree<Value>::enumerate(const Node &node,const std::function<void(const Value&)> &processor)
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+void BTree<Value,Allocator,Statistics,NodeOwnership>::enumerate(const Node &node,const std::function<void(const Value&)> &processor)
 {
     for(size_t index=0;index<node.values_.size();++index)
     {
         if(!node.children_.empty())
-            enumerate(node.children_[index],processor);
+            enumerate(*node.children_[index],processor);
         processor(node.values_[index]);
     }
     if(!node.children_.empty())
-        enumerate(node.children_.back(),processor);
+        enumerate(*node.children_.back(),processor);
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+bool BTree<Value,Allocator,Statistics,NodeOwnership>::enumerateRange(
+    const Node &node,
+    const Value &from,
+    const Value &to,
+    const std::function<void(const Value&)> &processor)
+{
+    for(auto index=findIndexForValue(node.values_,from);index<=node.values_.size();++index)
+    {
+        if(!node.children_.empty() && !enumerateRange(*node.children_[index],from,to,processor))
+            return false;
+        if(index==node.values_.size())
+            break;
+        if(!(node.values_[index]<to))
+            return false;
+        processor(node.values_[index]);
+    }
+    return true;
 }
-template<typename Value>
-void BTree<Value>::splitChild(Node &node,size_t childIndex)
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+void BTree<Value,Allocator,Statistics,NodeOwnership>::addLeaves(const Node &node,LeafFill &fill) const
+{
+    if(node.children_.empty())
+        fill.addLeaf(node.values_.size(),maxChunkSize_);
+    for(const auto &child:node.children_)
+        addLeaves(*child,fill);
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+void BTree<Value,Allocator,Statistics,NodeOwnership>::splitChild(Node &node,size_t childIndex)
 {
     node.children_.emplace(node.children_.begin()+childIndex+1);//do this at the start to not invalidate references later
-    auto &child=node.children_[childIndex];
+    auto &child=*node.children_[childIndex];
     size_t leftHalfSize=child.values_.size()/2;
+    Statistics::add(Counter::split);
+    Statistics::add(Counter::movedValue,child.values_.size()-leftHalfSize);
     node.values_.insert(node.values_.begin()+childIndex,child.values_[leftHalfSize]);
-    auto &secondChild=node.children_[childIndex+1];
+    auto &secondChild=*node.children_[childIndex+1];
     for(size_t index=leftHalfSize+1;index<child.values_.size();++index)
         secondChild.values_.push_back(std::move(child.values_[index]));
     child.values_.resize(leftHalfSize);
@@ -163,15 +776,16 @@ void BTree<Value>::splitChild(Node &node,size_t childIndex)
         child.children_.resize(leftHalfSize+1);
     }
 }
-template<typename Value>
-void BTree<Value>::mergeChild(Node &node,size_t childIndex)
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+void BTree<Value,Allocator,Statistics,NodeOwnership>::mergeChild(Node &node,size_t childIndex)
 {
     if(childIndex+1>=node.children_.size())
         --childIndex;
-    else if(childIndex>0 && node.children_[childIndex-1].values_.size()>node.children_[childIndex+1].values_.size())
+    else if(childIndex>0 && getSize(node.children_[childIndex-1])>getSize(node.children_[childIndex+1]))
         --childIndex;
-    auto &target=node.children_[childIndex];
-    auto &source=node.children_[childIndex+1];
+    Statistics::add(Counter::merge);
+    auto &target=*node.children_[childIndex];
+    auto &source=*node.children_[childIndex+1];
     target.values_.push_back(std::move(node.values_[childIndex]));
     node.values_.erase(node.values_.begin()+childIndex);
     for(auto &value:source.values_)
@@ -180,8 +794,58 @@ void BTree<Value>::mergeChild(Node &node,size_t childIndex)
         target.children_.push_back(std::move(child));
     node.children_.erase(node.children_.begin()+childIndex+1);
 }
-template<typename Value>
-size_t BTree<Value>::findIndexForValue(const std::vector<Value> &values,const Value &value)
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+bool BTree<Value,Allocator,Statistics,NodeOwnership>::borrowFromSibling(Node &node,size_t childIndex,size_t minChunkSize)
+{//values rotate through the separator until both nodes have the same size
+    const bool hasLeft=(childIndex>0);
+    const bool hasRight=(childIndex+1<node.children_.size());
+    const bool fromLeft=hasLeft
+        && (!hasRight || getSize(node.children_[childIndex-1])>getSize(node.children_[childIndex+1]));
+    if(getSize(node.children_[fromLeft?childIndex-1:childIndex+1])<=minChunkSize)
+        return false;
+    auto &child=*node.children_[childIndex];
+    auto &sibling=*node.children_[fromLeft?childIndex-1:childIndex+1];
+    const auto count=(sibling.values_.size()-child.values_.size())/2;
+    if(fromLeft)
+    {
+        auto &separator=node.values_[childIndex-1];
+        const auto first=sibling.values_.end()-count;
+        Values values;
+        values.reserve(count+child.values_.size());
+        std::move(first+1,sibling.values_.end(),std::back_inserter(values));
+        values.push_back(std::move(separator));
+        std::move(child.values_.begin(),child.values_.end(),std::back_inserter(values));
+        child.values_=std::move(values);
+        separator=std::move(*first);
+        sibling.values_.erase(first,sibling.values_.end());
+        if(!child.children_.empty())
+        {
+            const auto firstChild=sibling.children_.end()-count;
+            Nodes children;
+            children.reserve(count+child.children_.size());
+            std::move(firstChild,sibling.children_.end(),std::back_inserter(children));
+            std::move(child.children_.begin(),child.children_.end(),std::back_inserter(children));
+            child.children_=std::move(children);
+            sibling.children_.erase(firstChild,sibling.children_.end());
+        }
+    }
+    else
+    {
+        auto &separator=node.values_[childIndex];
+        child.values_.push_back(std::move(separator));
+        std::move(sibling.values_.begin(),sibling.values_.begin()+count-1,std::back_inserter(child.values_));
+        separator=std::move(sibling.values_[count-1]);
+        sibling.values_.erase(sibling.values_.begin(),sibling.values_.begin()+count);
+        if(!child.children_.empty())
+        {
+            std::move(sibling.children_.begin(),sibling.children_.begin()+count,std::back_inserter(child.children_));
+            sibling.children_.erase(sibling.children_.begin(),sibling.children_.begin()+count);
+        }
+    }
+    return true;
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+size_t BTree<Value,Allocator,Statistics,NodeOwnership>::findIndexForValue(const Values &values,const Value &value)
 {
     size_t current=values.size();
     size_t step=values.size();
@@ -194,29 +858,303 @@ size_t BTree<Value>::findIndexForValue(const std::vector<Value> &values,const Va
     }
     return current;
 }
-template<typename Value>
-const Value &BTree<Value>::getMinValue(const Node &node)
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+size_t BTree<Value,Allocator,Statistics,NodeOwnership>::getSize(const NodePointer &node)
+{
+    return node->values_.size();
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+const Value &BTree<Value,Allocator,Statistics,NodeOwnership>::getMinValue(const Node &node)
 {
     if(node.children_.empty())
         return node.values_.front();
     else
-        return getMinValue(node.children_.front());
+        return getMinValue(*node.children_.front());
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+const Value &BTree<Value,Allocator,Statistics,NodeOwnership>::getMaxValue(const Node &node)
+{
+    if(node.children_.empty())
+        return node.values_.back();
+    else
+        return getMaxValue(*node.children_.back());
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+void BTree<Value,Allocator,Statistics,NodeOwnership>::collect(const Node &node,const Value &from,const Value &to,Values &values)
+{
+    for(auto index=findIndexForValue(node.values_,from);index<=node.values_.size();++index)
+    {//children before the found index hold only values<from and are skipped entirely
+        if(!node.children_.empty())
+            collect(*node.children_[index],from,to,values);
+        if(index==node.values_.size() || to<node.values_[index])
+            break;
+        values.push_back(node.values_[index]);
+    }
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+typename BTree<Value,Allocator,Statistics,NodeOwnership>::Values BTree<Value,Allocator,Statistics,NodeOwnership>::collect(const BTree &tree)
+{
+    Values values;
+    if(!tree.first_.empty())
+        tree.collect(tree.min(),tree.max(),values);
+    return values;
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+void BTree<Value,Allocator,Statistics,NodeOwnership>::intersect(
+    const Node &node,
+    typename Values::const_iterator begin,
+    typename Values::const_iterator end,
+    Values &found)
+{
+    if(node.children_.empty())
+    {
+        size_t position=0;
+        for(;begin!=end;++begin)
+        {
+            position=gallop(node.values_,position,*begin);
+            if(position==node.values_.size())
+                break;
+            if(node.values_[position]==*begin)
+                found.push_back(*begin);
+        }
+        return;
+    }
+    while(begin!=end)
+    {//only children whose range holds some of the values are entered
+        const auto index=findIndexForValue(node.values_,*begin);
+        if(index<node.values_.size() && node.values_[index]==*begin)
+        {
+            found.push_back(*begin);
+            ++begin;
+            continue;
+        }
+        const auto childEnd=index<node.values_.size()?std::lower_bound(begin,end,node.values_[index]):end;
+        intersect(*node.children_[index],begin,childEnd,found);
+        begin=childEnd;
+    }
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+typename BTree<Value,Allocator,Statistics,NodeOwnership>::Node BTree<Value,Allocator,Statistics,NodeOwnership>::buildFromSorted(
+    Values values,
+    size_t minChunkSize,
+    size_t maxChunkSize)
+{
+    Nodes nodes;
+    do
+        buildLevel(values,nodes,minChunkSize,maxChunkSize);
+    while(nodes.size()>1);
+    return std::move(*nodes.front());
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+void BTree<Value,Allocator,Statistics,NodeOwnership>::buildLevel(
+    Values &values,
+    Nodes &children,
+    size_t minChunkSize,
+    size_t maxChunkSize)
+{//values (and children, if any) are distributed over new nodes, values between the nodes are returned as separators
+    const auto targetChunkSize=(minChunkSize+maxChunkSize)/2;
+    auto nodeCount=std::max<size_t>((values.size()+1+targetChunkSize/2)/(targetChunkSize+1),1);
+    while(nodeCount>1 && (values.size()-(nodeCount-1))/nodeCount<minChunkSize)
+        --nodeCount;
+    while(values.size()/nodeCount>maxChunkSize)//the largest node would be too large
+        ++nodeCount;
+    const auto valueCount=values.size()-(nodeCount-1);
+    Nodes nodes(nodeCount);
+    Values separators;
+    size_t position=0;
+    for(size_t nodeIndex=0;nodeIndex<nodeCount;++nodeIndex)
+    {
+        const auto size=valueCount/nodeCount+(nodeIndex<valueCount%nodeCount?1:0);
+        auto &node=*nodes[nodeIndex];
+        std::move(values.begin()+position,values.begin()+position+size,std::back_inserter(node.values_));
+        if(!children.empty())
+            std::move(children.begin()+position,children.begin()+position+size+1,std::back_inserter(node.children_));
+        position+=size;
+        if(nodeIndex+1<nodeCount)
+            separators.push_back(std::move(values[position++]));
+    }
+    values=std::move(separators);
+    children=std::move(nodes);
 }
-template<typename Value>
-void BTree<Value>::eraseFromChildWithRebalancing(
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+void BTree<Value,Allocator,Statistics,NodeOwnership>::eraseFromChildWithRebalancing(
     const Value &value,
     Node &node,
     size_t childIndex,
     size_t minChunkSize,
-    size_t maxChunkSize)
+    size_t maxChunkSize,
+    size_t underflowChunkSize)
+{
+    erase(value,*node.children_[childIndex],minChunkSize,maxChunkSize,underflowChunkSize);
+    rebalanceChild(node,childIndex,minChunkSize,maxChunkSize,underflowChunkSize);
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+void BTree<Value,Allocator,Statistics,NodeOwnership>::rebalanceChild(
+    Node &node,
+    size_t childIndex,
+    size_t minChunkSize,
+    size_t maxChunkSize,
+    size_t underflowChunkSize)
 {
-    erase(value,node.children_[childIndex],minChunkSize,maxChunkSize);
-    if(node.children_[childIndex].values_.size()<minChunkSize && node.children_.size()>1)
+    if(getSize(node.children_[childIndex])<underflowChunkSize && node.children_.size()>1)
     {
+        if(borrowFromSibling(node,childIndex,minChunkSize))
+            return;//moves only a few values and leaves both nodes away from the limits
         mergeChild(node,childIndex);
-        if(childIndex<node.children_.size() && node.children_[childIndex].values_.size()>maxChunkSize)
+        if(childIndex<node.children_.size() && getSize(node.children_[childIndex])>maxChunkSize)
             splitChild(node,childIndex);
-        else if(childIndex>0 && node.children_[childIndex-1].values_.size()>maxChunkSize)
+        else if(childIndex>0 && getSize(node.children_[childIndex-1])>maxChunkSize)
             splitChild(node,childIndex-1);
     }
 }
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+size_t BTree<Value,Allocator,Statistics,NodeOwnership>::getHeight(const Node &node)
+{
+    if(node.children_.empty())
+        return 1;
+    else
+        return getHeight(*node.children_.front())+1;
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+size_t BTree<Value,Allocator,Statistics,NodeOwnership>::getValueCount(const Node &node)
+{
+    auto count=node.values_.size();
+    for(const auto &child:node.children_)
+        count+=getValueCount(*child);
+    return count;
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+void BTree<Value,Allocator,Statistics,NodeOwnership>::split(Node &&node,const Value &value,BTree &left,BTree &right)
+{//the path to the value is cut, subtrees on each side are joined back with the separators between them
+    auto &values=node.values_;
+    auto &children=node.children_;
+    const auto index=findIndexForValue(values,value);
+    if(children.empty())
+    {
+        std::move(values.begin(),values.begin()+index,std::back_inserter(left.root_.values_));
+        std::move(values.begin()+index,values.end(),std::back_inserter(right.root_.values_));
+        return;
+    }
+    BTree leftPart(left.minChunkSize_,left.maxChunkSize_,left.underflowSlack_);
+    BTree rightPart(right.minChunkSize_,right.maxChunkSize_,right.underflowSlack_);
+    if(index<values.size() && values[index]==value)
+        leftPart.root_=std::move(*children[index]);//the separator itself goes to the right tree below
+    else
+        split(std::move(*children[index]),value,leftPart,rightPart);
+    if(index==0)
+        left=std::move(leftPart);
+    else
+    {
+        BTree siblings(left.minChunkSize_,left.maxChunkSize_,left.underflowSlack_);
+        std::move(values.begin(),values.begin()+index-1,std::back_inserter(siblings.root_.values_));
+        std::move(children.begin(),children.begin()+index,std::back_inserter(siblings.root_.children_));
+        siblings.decreaseDepthIfNeeded();
+        left=join(std::move(siblings),std::move(values[index-1]),std::move(leftPart));
+    }
+    if(index==values.size())
+        right=std::move(rightPart);
+    else
+    {
+        BTree siblings(right.minChunkSize_,right.maxChunkSize_,right.underflowSlack_);
+        std::move(values.begin()+index+1,values.end(),std::back_inserter(siblings.root_.values_));
+        std::move(children.begin()+index+1,children.end(),std::back_inserter(siblings.root_.children_));
+        siblings.decreaseDepthIfNeeded();
+        right=join(std::move(rightPart),std::move(values[index]),std::move(siblings));
+    }
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+BTree<Value,Allocator,Statistics,NodeOwnership> BTree<Value,Allocator,Statistics,NodeOwnership>::join(BTree &&left,Value &&separator,BTree &&right)
+{//the lower tree becomes a child of the higher one at the matching level
+    if(left.root_.values_.empty())
+    {
+        right.insertIntoTree(separator);
+        return std::move(right);
+    }
+    if(right.root_.values_.empty())
+    {
+        left.insertIntoTree(separator);
+        return std::move(left);
+    }
+    const auto minChunkSize=left.minChunkSize_;
+    const auto maxChunkSize=left.maxChunkSize_;
+    const auto leftHeight=getHeight(left.root_);
+    const auto rightHeight=getHeight(right.root_);
+    BTree result(minChunkSize,maxChunkSize,left.underflowSlack_);
+    if(leftHeight==rightHeight)
+    {
+        result.root_.values_.push_back(std::move(separator));
+        result.root_.children_.push_back(std::move(left.root_));
+        result.root_.children_.push_back(std::move(right.root_));
+        rebalanceChild(result.root_,0,minChunkSize,maxChunkSize,minChunkSize);
+        if(result.root_.children_.size()>1)
+            rebalanceChild(result.root_,1,minChunkSize,maxChunkSize,minChunkSize);
+    }
+    else if(leftHeight>rightHeight)
+    {
+        result.root_=std::move(left.root_);
+        attachRight(result.root_,leftHeight-rightHeight,std::move(separator),std::move(right.root_),minChunkSize,maxChunkSize);
+    }
+    else
+    {
+        result.root_=std::move(right.root_);
+        attachLeft(result.root_,rightHeight-leftHeight,std::move(left.root_),std::move(separator),minChunkSize,maxChunkSize);
+    }
+    result.decreaseDepthIfNeeded();
+    result.increaseDepthIfNeeded();
+    return result;
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+BTree<Value,Allocator,Statistics,NodeOwnership> BTree<Value,Allocator,Statistics,NodeOwnership>::joinTrees(BTree &&left,BTree &&right)
+{
+    if(left.root_.values_.empty())
+        return std::move(right);
+    if(right.root_.values_.empty())
+        return std::move(left);
+    auto separator=getMinValue(right.root_);
+    right.eraseFromTree(separator);
+    return join(std::move(left),std::move(separator),std::move(right));
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+void BTree<Value,Allocator,Statistics,NodeOwnership>::attachRight(
+    Node &node,
+    size_t heightDifference,
+    Value &&separator,
+    Node &&right,
+    size_t minChunkSize,
+    size_t maxChunkSize)
+{
+    if(heightDifference==1)
+    {
+        node.values_.push_back(std::move(separator));
+        node.children_.push_back(std::move(right));
+        rebalanceChild(node,node.children_.size()-1,minChunkSize,maxChunkSize,minChunkSize);
+    }
+    else
+    {
+        attachRight(*node.children_.back(),heightDifference-1,std::move(separator),std::move(right),minChunkSize,maxChunkSize);
+        if(getSize(node.children_.back())>maxChunkSize)
+            splitChild(node,node.children_.size()-1);
+    }
+}
+template<typename Value,typename Allocator,typename Statistics,typename NodeOwnership>
+void BTree<Value,Allocator,Statistics,NodeOwnership>::attachLeft(
+    Node &node,
+    size_t heightDifference,
+    Node &&left,
+    Value &&separator,
+    size_t minChunkSize,
+    size_t maxChunkSize)
+{
+    if(heightDifference==1)
+    {
+        node.values_.insert(node.values_.begin(),std::move(separator));
+        node.children_.insert(node.children_.begin(),std::move(left));
+        rebalanceChild(node,0,minChunkSize,maxChunkSize,minChunkSize);
+    }
+    else
+    {
+        attachLeft(*node.children_.front(),heightDifference-1,std::move(left),std::move(separator),minChunkSize,maxChunkSize);
+        if(getSize(node.children_.front())>maxChunkSize)
+            splitChild(node,0);
+    }
+}
@@ -0,0 +1,406 @@
+#pragma once
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <vector>
+//write-optimized (B-epsilon) tree: values are stored in leaves, inner nodes keep pivots
+//and a buffer of pending insert/erase messages;
+//when a buffer overflows, the longest run of messages for one child goes one level down in bulk,
+//so a descent and a pass over a leaf are shared by many writes;
+//inner nodes use a small fanout to leave room for large buffers
+template<typename Value>
+class BufferedBTree
+{
+public:
+    class Iterator;
+    BufferedBTree(size_t minChunkSize,size_t maxChunkSize,size_t fanout,size_t bufferSize);
+    void insert(const Value&);
+    void erase(const Value&);
+    bool contains(const Value&) const;
+    void enumerate(const std::function<void(const Value&)>&) const;
+private:
+    struct Message
+    {
+        Value value_;
+        bool isInsertion_;
+    };
+    using Messages=std::vector<Message>;//sorted by value, at most one message per value (except the log)
+    struct Node
+    {
+        std::vector<Value> values_;//values in a leaf, pivots in an inner node: values_[i]<=everything in children_[i+1]
+        std::vector<Node> children_;
+        Messages buffer_;//always empty in leaves
+    };
+    static const size_t logSize=128;//the newest messages are just appended, so a write doesn't shift the root buffer
+    static const size_t smallRunFactor=16;//runs shorter than leaf/smallRunFactor are applied one by one
+    size_t minChunkSize_,maxChunkSize_;
+    size_t minFanout_,maxFanout_;
+    size_t bufferSize_;
+    Node root_;
+    Messages log_;//unsorted, the newest message is the last one
+    void write(const Message&);
+    void flushLog();
+    void increaseDepthIfNeeded();
+    void decreaseDepthIfNeeded();
+    void flush(Node&) const;
+    void apply(Messages&&,Node&) const;
+    void rebalanceChildren(Node&) const;
+    size_t getMinNodeSize(const Node&) const;
+    size_t getMaxNodeSize(const Node&) const;
+    static bool contains(const Node&,const Value&);
+    static void enumerate(const Node&,const Messages &pending,const std::function<void(const Value&)>&);
+    static size_t getNodeSize(const Node&);
+    static void splitChild(Node&,size_t childIndex);
+    static size_t mergeChild(Node&,size_t childIndex);//returns index of the merged node
+    static size_t findChildIndexForValue(const std::vector<Value> &pivots,const Value&);
+    static size_t findIndexForValue(const std::vector<Value>&,const Value&);//returns first element>=value
+    static size_t findMessageIndex(const Messages&,const Value&,size_t start=0);//returns first message with value>=value
+    static Messages sortLog(const Messages&);
+    static Messages mergeMessages(const Messages &older,const Messages &newer);
+    static void removeOverriddenMessages(Messages&);//of equal neighbours only the last one stays
+    static void applyToValues(
+        const std::vector<Value>&,
+        const Messages&,
+        const std::function<void(const Value&)> &processor);//passes the resulting values in order
+};
+///////////////////////////////////////////////////////////////////////////////
+template<typename Value>
+BufferedBTree<Value>::BufferedBTree(size_t minChunkSize,size_t maxChunkSize,size_t fanout,size_t bufferSize)
+    :minChunkSize_(minChunkSize)
+    ,maxChunkSize_(maxChunkSize)
+    ,minFanout_(std::max<size_t>(fanout/2,2))
+    ,maxFanout_(std::max<size_t>(fanout,4))
+    ,bufferSize_(bufferSize)
+{}
+template<typename Value>
+void BufferedBTree<Value>::insert(const Value &value)
+{
+    write({value,true});
+}
+template<typename Value>
+void BufferedBTree<Value>::erase(const Value &value)
+{
+    write({value,false});
+}
+template<typename Value>
+bool BufferedBTree<Value>::contains(const Value &value) const
+{
+    for(auto message=log_.rbegin();message!=log_.rend();++message)
+        if(message->value_==value)
+            return message->isInsertion_;
+    return contains(root_,value);
+}
+template<typename Value>
+void BufferedBTree<Value>::enumerate(const std::function<void(const Value&)> &processor) const
+{
+    enumerate(root_,sortLog(log_),processor);
+}
+template<typename Value>
+void BufferedBTree<Value>::write(const Message &message)
+{
+    log_.push_back(message);
+    if(log_.size()>=logSize)
+        flushLog();
+}
+template<typename Value>
+void BufferedBTree<Value>::flushLog()
+{
+    auto messages=sortLog(log_);
+    log_.clear();
+    apply(std::move(messages),root_);
+    decreaseDepthIfNeeded();
+    increaseDepthIfNeeded();
+}
+template<typename Value>
+void BufferedBTree<Value>::increaseDepthIfNeeded()
+{
+    while(getNodeSize(root_)>getMaxNodeSize(root_))
+    {
+        Node newRoot;
+        newRoot.children_.push_back(std::move(root_));
+        root_=std::move(newRoot);
+        rebalanceChildren(root_);
+    }
+}
+template<typename Value>
+void BufferedBTree<Value>::decreaseDepthIfNeeded()
+{
+    while(root_.children_.size()==1)
+    {//the buffer has nowhere to stay, so it goes down with the child
+        auto messages=std::move(root_.buffer_);
+        auto newRoot=std::move(root_.children_.front());
+        apply(std::move(messages),newRoot);
+        root_=std::move(newRoot);
+    }
+}
+template<typename Value>
+void BufferedBTree<Value>::flush(Node &node) const
+{//messages are sorted, so each child has a contiguous run of them; the longest run goes down
+    size_t bestBegin=0,bestEnd=0,bestChildIndex=0;
+    size_t begin=0;
+    for(size_t childIndex=0;begin<node.buffer_.size();++childIndex)
+    {
+        size_t end=node.buffer_.size();
+        if(childIndex<node.values_.size())
+            end=findMessageIndex(node.buffer_,node.values_[childIndex],begin);
+        if(end-begin>bestEnd-bestBegin)
+        {
+            bestBegin=begin;
+            bestEnd=end;
+            bestChildIndex=childIndex;
+        }
+        begin=end;
+    }
+    Messages messages(
+        std::make_move_iterator(node.buffer_.begin()+bestBegin),
+        std::make_move_iterator(node.buffer_.begin()+bestEnd));
+    node.buffer_.erase(node.buffer_.begin()+bestBegin,node.buffer_.begin()+bestEnd);
+    apply(std::move(messages),node.children_[bestChildIndex]);
+    rebalanceChildren(node);
+}
+template<typename Value>
+void BufferedBTree<Value>::apply(Messages &&messages,Node &node) const
+{
+    if(!node.children_.empty())
+    {
+        auto &buffer=node.buffer_;
+        const auto oldSize=buffer.size();
+        std::move(messages.begin(),messages.end(),std::back_inserter(buffer));
+        std::inplace_merge(//stable, so older messages stay in front of newer ones with the same value
+            buffer.begin(),
+            buffer.begin()+oldSize,
+            buffer.end(),
+            [](const Message &first,const Message &second){return first.value_<second.value_;});
+        removeOverriddenMessages(buffer);
+        while(buffer.size()>bufferSize_)
+            flush(node);
+    }
+    else if(messages.size()*smallRunFactor<node.values_.size())
+    {//a few messages for a large leaf: shifting is cheaper than rebuilding
+        auto &values=node.values_;
+        for(const auto &message:messages)
+        {
+            const auto index=findIndexForValue(values,message.value_);
+            const bool isPresent=(index<values.size() && values[index]==message.value_);
+            if(message.isInsertion_ && !isPresent)
+                values.insert(values.begin()+index,message.value_);
+            else if(!message.isInsertion_ && isPresent)
+                values.erase(values.begin()+index);
+        }
+    }
+    else
+    {
+        std::vector<Value> values;
+        values.reserve(node.values_.size()+messages.size());
+        applyToValues(node.values_,messages,[&](const Value &value){values.push_back(value);});
+        node.values_=std::move(values);
+    }
+}
+template<typename Value>
+void BufferedBTree<Value>::rebalanceChildren(Node &node) const
+{//after a flush a child can be off by more than one split or merge
+    for(size_t index=0;index<node.children_.size();)
+    {
+        const auto &child=node.children_[index];
+        const auto size=getNodeSize(child);
+        if(size>getMaxNodeSize(child))
+            splitChild(node,index);//the left half is checked again
+        else if(size<getMinNodeSize(child) && node.children_.size()>1)
+            index=mergeChild(node,index);//the merged node is checked again
+        else
+            ++index;
+    }
+}
+template<typename Value>
+size_t BufferedBTree<Value>::getMinNodeSize(const Node &node) const
+{
+    return (node.children_.empty()?minChunkSize_:minFanout_);
+}
+template<typename Value>
+size_t BufferedBTree<Value>::getMaxNodeSize(const Node &node) const
+{
+    return (node.children_.empty()?maxChunkSize_:maxFanout_);
+}
+template<typename Value>
+bool BufferedBTree<Value>::contains(const Node &node,const Value &value)
+{
+    if(node.children_.empty())
+    {
+        const auto index=findIndexForValue(node.values_,value);
+        return (index<node.values_.size() && node.values_[index]==value);
+    }
+    const auto messageIndex=findMessageIndex(node.buffer_,value);
+    if(messageIndex<node.buffer_.size() && node.buffer_[messageIndex].value_==value)
+        return node.buffer_[messageIndex].isInsertion_;
+    return contains(node.children_[findChildIndexForValue(node.values_,value)],value);
+}
+template<typename Value>
+void BufferedBTree<Value>::enumerate(
+    const Node &node,
+    const Messages &pending,
+    const std::function<void(const Value&)> &processor)
+{
+    if(node.children_.empty())
+    {
+        applyToValues(node.values_,pending,processor);
+        return;
+    }
+    const auto messages=mergeMessages(node.buffer_,pending);
+    size_t begin=0;
+    for(size_t childIndex=0;childIndex<node.children_.size();++childIndex)
+    {
+        size_t end=messages.size();
+        if(childIndex<node.values_.size())
+            end=findMessageIndex(messages,node.values_[childIndex],begin);
+        enumerate(node.children_[childIndex],Messages(messages.begin()+begin,messages.begin()+end),processor);
+        begin=end;
+    }
+}
+template<typename Value>
+size_t BufferedBTree<Value>::getNodeSize(const Node &node)
+{
+    if(node.children_.empty())
+        return node.values_.size();
+    else
+        return node.children_.size();
+}
+template<typename Value>
+void BufferedBTree<Value>::splitChild(Node &node,size_t childIndex)
+{
+    node.children_.emplace(node.children_.begin()+childIndex+1);//do this at the start to not invalidate references later
+    auto &child=node.children_[childIndex];
+    auto &secondChild=node.children_[childIndex+1];
+    if(child.children_.empty())
+    {
+        const auto middle=child.values_.begin()+child.values_.size()/2;
+        node.values_.insert(node.values_.begin()+childIndex,*middle);
+        std::move(middle,child.values_.end(),std::back_inserter(secondChild.values_));
+        child.values_.erase(middle,child.values_.end());
+    }
+    else
+    {//the pivot between the halves goes up, the buffer is split by it
+        const auto leftChildCount=child.children_.size()/2;
+        const auto pivot=child.values_.begin()+leftChildCount-1;
+        node.values_.insert(node.values_.begin()+childIndex,*pivot);
+        std::move(pivot+1,child.values_.end(),std::back_inserter(secondChild.values_));
+        child.values_.erase(pivot,child.values_.end());
+        std::move(child.children_.begin()+leftChildCount,child.children_.end(),std::back_inserter(secondChild.children_));
+        child.children_.erase(child.children_.begin()+leftChildCount,child.children_.end());
+        const auto bufferMiddle=child.buffer_.begin()+findMessageIndex(child.buffer_,node.values_[childIndex]);
+        std::move(bufferMiddle,child.buffer_.end(),std::back_inserter(secondChild.buffer_));
+        child.buffer_.erase(bufferMiddle,child.buffer_.end());
+    }
+}
+template<typename Value>
+size_t BufferedBTree<Value>::mergeChild(Node &node,size_t childIndex)
+{
+    if(childIndex>0)
+    {//consider merging to the left node
+        if(childIndex+1>=node.children_.size())
+            --childIndex;
+        else if(getNodeSize(node.children_[childIndex-1])<getNodeSize(node.children_[childIndex+1]))
+            --childIndex;
+    }
+    auto &target=node.children_[childIndex];
+    auto &source=node.children_[childIndex+1];
+    if(!target.children_.empty())
+        target.values_.push_back(std::move(node.values_[childIndex]));
+    std::move(source.values_.begin(),source.values_.end(),std::back_inserter(target.values_));
+    std::move(source.children_.begin(),source.children_.end(),std::back_inserter(target.children_));
+    std::move(source.buffer_.begin(),source.buffer_.end(),std::back_inserter(target.buffer_));//all of them are greater
+    node.values_.erase(node.values_.begin()+childIndex);
+    node.children_.erase(node.children_.begin()+childIndex+1);
+    return childIndex;
+}
+template<typename Value>
+size_t BufferedBTree<Value>::findChildIndexForValue(const std::vector<Value> &pivots,const Value &value)
+{
+    return std::upper_bound(pivots.begin(),pivots.end(),value)-pivots.begin();
+}
+template<typename Value>
+size_t BufferedBTree<Value>::findIndexForValue(const std::vector<Value> &values,const Value &value)
+{
+    size_t current=values.size();
+    size_t step=values.size();
+    while(step>0)
+    {
+        if(current<step || values[current-step]<value)
+            step/=2;
+        else
+            current-=step;
+    }
+    return current;
+}
+template<typename Value>
+size_t BufferedBTree<Value>::findMessageIndex(const Messages &messages,const Value &value,size_t start)
+{
+    return std::lower_bound(
+        messages.begin()+start,
+        messages.end(),
+        value,
+        [](const Message &message,const Value &value){return message.value_<value;})-messages.begin();
+}
+template<typename Value>
+typename BufferedBTree<Value>::Messages BufferedBTree<Value>::sortLog(const Messages &log)
+{
+    auto messages=log;
+    std::stable_sort(
+        messages.begin(),
+        messages.end(),
+        [](const Message &first,const Message &second){return first.value_<second.value_;});
+    removeOverriddenMessages(messages);
+    return messages;
+}
+template<typename Value>
+typename BufferedBTree<Value>::Messages BufferedBTree<Value>::mergeMessages(const Messages &older,const Messages &newer)
+{
+    Messages result;
+    result.reserve(older.size()+newer.size());
+    size_t olderIndex=0,newerIndex=0;
+    while(olderIndex<older.size() || newerIndex<newer.size())
+    {
+        if(newerIndex==newer.size() || (olderIndex<older.size() && older[olderIndex].value_<newer[newerIndex].value_))
+            result.push_back(older[olderIndex++]);
+        else
+        {
+            if(olderIndex<older.size() && older[olderIndex].value_==newer[newerIndex].value_)
+                ++olderIndex;//overridden
+            result.push_back(newer[newerIndex++]);
+        }
+    }
+    return result;
+}
+template<typename Value>
+void BufferedBTree<Value>::removeOverriddenMessages(Messages &messages)
+{
+    size_t size=0;
+    for(size_t index=0;index<messages.size();++index)
+        if(index+1==messages.size() || messages[index+1].value_!=messages[index].value_)
+        {
+            if(size!=index)
+                messages[size]=std::move(messages[index]);
+            ++size;
+        }
+    messages.resize(size);
+}
+template<typename Value>
+void BufferedBTree<Value>::applyToValues(
+    const std::vector<Value> &values,
+    const Messages &messages,
+    const std::function<void(const Value&)> &processor)
+{
+    size_t valueIndex=0,messageIndex=0;
+    while(valueIndex<values.size() || messageIndex<messages.size())
+    {
+        if(messageIndex==messages.size() || (valueIndex<values.size() && values[valueIndex]<messages[messageIndex].value_))
+            processor(values[valueIndex++]);
+        else
+        {
+            const auto &message=messages[messageIndex++];
+            if(valueIndex<values.size() && values[valueIndex]==message.value_)
+                ++valueIndex;//the message decides whether it stays
+            if(message.isInsertion_)
+                processor(message.value_);
+        }
+    }
+}
@@ -0,0 +1,137 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <vector>
+//wraps any container with a blocked Bloom filter, so that most lookups of absent values don't reach the container:
+//a value sets one bit in each of the 8 words of a single 64-byte block, a lookup reads one cache line
+//and tests all words without branches;
+//erasing can't clear bits, so the filter is rebuilt from the container once erasures could have left it half stale,
+//and with twice the capacity once it gets full
+template<typename Value,typename Set>
+class FilteredSet
+{
+public:
+    class Iterator;
+    explicit FilteredSet(const Set &prototype,size_t bitsPerValue=16);
+    void insert(const Value&);
+    void erase(const Value&);
+    bool contains(const Value&) const;
+    void enumerate(const std::function<void(const Value&)>&) const;
+private:
+    static const size_t wordsPerBlock=8;
+    static const size_t minCapacity=1024;//values
+    struct alignas(64) Block
+    {
+        std::uint64_t words_[wordsPerBlock];
+    };
+    Set set_;
+    size_t bitsPerValue_;
+    std::vector<Block> blocks_;
+    size_t capacity_;//values the filter was sized for
+    size_t valueCount_;//at the last rebuild
+    size_t insertCount_,eraseCount_;//since the last rebuild, not all of them changed the content
+    void rebuild();
+    void add(const Value&);
+    bool mayContain(const Value&) const;
+    size_t getBlockIndex(std::uint64_t hash) const;
+    static std::uint64_t getHash(const Value&);
+    static size_t getBitIndex(std::uint64_t hash,size_t wordIndex);
+};
+///////////////////////////////////////////////////////////////////////////////
+template<typename Value,typename Set>
+FilteredSet<Value,Set>::FilteredSet(const Set &prototype,size_t bitsPerValue)
+    :set_(prototype)
+    ,bitsPerValue_(bitsPerValue)
+    ,capacity_(0)
+    ,valueCount_(0)
+    ,insertCount_(0)
+    ,eraseCount_(0)
+{
+    rebuild();
+}
+template<typename Value,typename Set>
+void FilteredSet<Value,Set>::insert(const Value &value)
+{
+    set_.insert(value);
+    ++insertCount_;
+    if(valueCount_+insertCount_>capacity_)
+        rebuild();
+    else
+        add(value);
+}
+template<typename Value,typename Set>
+void FilteredSet<Value,Set>::erase(const Value &value)
+{
+    if(!mayContain(value))
+        return;
+    set_.erase(value);
+    ++eraseCount_;
+    if(eraseCount_*2>valueCount_+insertCount_)
+        rebuild();
+}
+template<typename Value,typename Set>
+bool FilteredSet<Value,Set>::contains(const Value &value) const
+{
+    return mayContain(value) && set_.contains(value);
+}
+template<typename Value,typename Set>
+void FilteredSet<Value,Set>::enumerate(const std::function<void(const Value&)> &processor) const
+{
+    set_.enumerate(processor);
+}
+template<typename Value,typename Set>
+void FilteredSet<Value,Set>::rebuild()
+{
+    const auto upperCount=valueCount_+insertCount_;
+    const auto estimatedCount=upperCount-std::min(eraseCount_,upperCount);//exact count is known after the rebuild
+    capacity_=std::max(size_t(minCapacity),estimatedCount*2);
+    const auto blockCount=(capacity_*bitsPerValue_+sizeof(Block)*8-1)/(sizeof(Block)*8);
+    blocks_.assign(blockCount,Block());
+    valueCount_=0;
+    set_.enumerate([&](const Value &value)
+    {
+        add(value);
+        ++valueCount_;
+    });
+    insertCount_=0;
+    eraseCount_=0;
+}
+template<typename Value,typename Set>
+void FilteredSet<Value,Set>::add(const Value &value)
+{
+    const auto hash=getHash(value);
+    auto &block=blocks_[getBlockIndex(hash)];
+    for(size_t wordIndex=0;wordIndex<wordsPerBlock;++wordIndex)
+        block.words_[wordIndex]|=std::uint64_t(1)<<getBitIndex(hash,wordIndex);
+}
+template<typename Value,typename Set>
+bool FilteredSet<Value,Set>::mayContain(const Value &value) const
+{
+    const auto hash=getHash(value);
+    const auto &block=blocks_[getBlockIndex(hash)];
+    std::uint64_t found=1;
+    for(size_t wordIndex=0;wordIndex<wordsPerBlock;++wordIndex)
+        found&=block.words_[wordIndex]>>getBitIndex(hash,wordIndex);
+    return found!=0;
+}
+template<typename Value,typename Set>
+size_t FilteredSet<Value,Set>::getBlockIndex(std::uint64_t hash) const
+{//upper half of the hash scaled to the block count, lower half is left for bits inside the block
+    return size_t(((hash>>32)*blocks_.size())>>32);
+}
+template<typename Value,typename Set>
+std::uint64_t FilteredSet<Value,Set>::getHash(const Value &value)
+{//std::hash is identity for integers on common implementations, so its result is mixed (splitmix64 finalizer)
+    std::uint64_t hash=std::hash<Value>()(value);
+    hash=(hash^(hash>>30))*0xbf58476d1ce4e5b9ull;
+    hash=(hash^(hash>>27))*0x94d049bb133111ebull;
+    return hash^(hash>>31);
+}
+template<typename Value,typename Set>
+size_t FilteredSet<Value,Set>::getBitIndex(std::uint64_t hash,size_t wordIndex)
+{//odd multipliers give each word an independent bit, as in the split block Bloom filter of Parquet
+    static const std::uint32_t salts[wordsPerBlock]=
+        {0x47b6137bu,0x44974d91u,0x8824ad5bu,0xa2b7289du,0x705495c7u,0x2df1424bu,0x9efc4947u,0x5c6bfb31u};
+    return (std::uint32_t(hash)*salts[wordIndex])>>26;
+}
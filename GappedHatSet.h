@@ -0,0 +1,82 @@
+#pragma once
+#include "GappedLeaf.h"
+#include <functional>
+#include <vector>
+//same as HatSet, but chunks keep gaps between values, so an insert doesn't move half of a big chunk
+template<typename Value>
+class GappedHatSet
+{
+public:
+    class Iterator;
+    GappedHatSet(size_t minChunkSize,size_t maxChunkSize);
+    void insert(const Value&);
+    void erase(const Value&);
+    bool contains(const Value&) const;
+    void enumerate(const std::function<void(const Value&)>&) const;
+private:
+    using Chunk=GappedLeaf<Value>;
+    size_t minChunkSize_,maxChunkSize_;
+    std::vector<Chunk> chunks_;
+    size_t findChunkIndex(const Value&) const;
+    void splitChunkIfNeeded(size_t chunkIndex);
+};
+///////////////////////////////////////////////////////////////////////////////
+template<typename Value>
+GappedHatSet<Value>::GappedHatSet(size_t minChunkSize,size_t maxChunkSize)
+    :minChunkSize_(minChunkSize)
+    ,maxChunkSize_(maxChunkSize)
+{}
+template<typename Value>
+void GappedHatSet<Value>::insert(const Value &value)
+{
+    if(chunks_.empty())
+        chunks_.emplace_back();
+    const auto chunkIndex=findChunkIndex(value);
+    if(chunks_[chunkIndex].insert(value))
+        splitChunkIfNeeded(chunkIndex);
+}
+template<typename Value>
+void GappedHatSet<Value>::erase(const Value &value)
+{
+    if(chunks_.empty())
+        return;
+    const auto chunkIndex=findChunkIndex(value);
+    auto &chunk=chunks_[chunkIndex];
+    if(chunk.erase(value) && chunk.empty())
+        chunks_.erase(chunks_.begin()+chunkIndex);
+}
+template<typename Value>
+bool GappedHatSet<Value>::contains(const Value &value) const
+{
+    if(chunks_.empty())
+        return false;
+    return chunks_[findChunkIndex(value)].contains(value);
+}
+template<typename Value>
+void GappedHatSet<Value>::enumerate(const std::function<void(const Value&)> &processor) const
+{
+    for(const auto &chunk:chunks_)
+        chunk.enumerate(processor);
+}
+template<typename Value>
+size_t GappedHatSet<Value>::findChunkIndex(const Value &value) const
+{
+    size_t index=0;
+    while(index+1<chunks_.size())
+    {
+        if(value<chunks_[index+1].front())
+            break;
+        else
+            ++index;
+    }
+    return index;
+}
+template<typename Value>
+void GappedHatSet<Value>::splitChunkIfNeeded(size_t chunkIndex)
+{
+    if(chunks_[chunkIndex].size()>maxChunkSize_)
+    {
+        auto upper=chunks_[chunkIndex].splitOff();
+        chunks_.insert(chunks_.begin()+chunkIndex+1,std::move(upper));
+    }
+}
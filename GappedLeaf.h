@@ -0,0 +1,289 @@
+#pragma once
+#include <functional>
+#include <vector>
+//sorted values spread over a larger array with gaps between them (packed-memory array):
+//an insert shifts values only up to the nearest gap in its segment,
+//a window around a segment is spread evenly again when the segment gets full,
+//each gap keeps a copy of the next value, so the whole array stays sorted and binary search ignores gaps
+template<typename Value>
+class GappedLeaf
+{
+public:
+    GappedLeaf();
+    explicit GappedLeaf(std::vector<Value> &&sortedValues);
+    size_t size() const;
+    bool empty() const;
+    const Value& front() const;
+    bool insert(const Value&);//returns false if the value was there already
+    bool erase(const Value&);//returns false if the value wasn't there
+    bool contains(const Value&) const;
+    void enumerate(const std::function<void(const Value&)>&) const;
+    GappedLeaf splitOff();//moves the upper half of values to the returned leaf
+private:
+    static const size_t segmentSize=32;
+    std::vector<Value> slots_;
+    std::vector<bool> used_;
+    size_t size_;
+    size_t findSlot(const Value&) const;//returns first slot>=value
+    void insertAt(size_t slot,const Value&);
+    void shiftInsideSegment(size_t slot,size_t segmentEnd,const Value&);
+    void spread(std::vector<Value> &&sortedValues,size_t begin,size_t end);
+    void rebuild(std::vector<Value> &&sortedValues);
+    void fillGapsBefore(size_t slot);//gaps just before the slot take its value
+    void fillTrailingGaps();
+    std::vector<Value> collect(size_t begin,size_t end) const;
+    size_t getMaxCount(size_t windowSize) const;
+};
+///////////////////////////////////////////////////////////////////////////////
+template<typename Value>
+GappedLeaf<Value>::GappedLeaf()
+    :size_(0)
+{}
+template<typename Value>
+GappedLeaf<Value>::GappedLeaf(std::vector<Value> &&sortedValues)
+    :size_(0)
+{
+    rebuild(std::move(sortedValues));
+}
+template<typename Value>
+size_t GappedLeaf<Value>::size() const
+{
+    return size_;
+}
+template<typename Value>
+bool GappedLeaf<Value>::empty() const
+{
+    return size_==0;
+}
+template<typename Value>
+const Value& GappedLeaf<Value>::front() const
+{//leading gaps copy the first value
+    return slots_.front();
+}
+template<typename Value>
+bool GappedLeaf<Value>::insert(const Value &value)
+{
+    if(size_==0)
+    {
+        rebuild(std::vector<Value>{value});
+        return true;
+    }
+    const auto slot=findSlot(value);
+    if(slot<slots_.size() && slots_[slot]==value)
+        return false;
+    ++size_;
+    insertAt(slot,value);
+    return true;
+}
+template<typename Value>
+bool GappedLeaf<Value>::erase(const Value &value)
+{
+    auto slot=findSlot(value);
+    if(slot==slots_.size() || slots_[slot]!=value)
+        return false;
+    while(!used_[slot])
+        ++slot;
+    used_[slot]=false;
+    --size_;
+    if(size_*8<slots_.size() && slots_.size()>segmentSize)
+    {
+        rebuild(collect(0,slots_.size()));
+        return true;
+    }
+    if(size_==0)
+    {
+        slots_.clear();
+        used_.clear();
+        return true;
+    }
+    if(slot+1<slots_.size() && slots_[slot+1]!=value)
+    {//the gap copies the next value, and so do the gaps before it
+        slots_[slot]=slots_[slot+1];
+        fillGapsBefore(slot);
+    }
+    else
+        fillTrailingGaps();
+    return true;
+}
+template<typename Value>
+bool GappedLeaf<Value>::contains(const Value &value) const
+{
+    const auto slot=findSlot(value);
+    return slot<slots_.size() && slots_[slot]==value;
+}
+template<typename Value>
+void GappedLeaf<Value>::enumerate(const std::function<void(const Value&)> &processor) const
+{
+    for(size_t slot=0;slot<slots_.size();++slot)
+        if(used_[slot])
+            processor(slots_[slot]);
+}
+template<typename Value>
+GappedLeaf<Value> GappedLeaf<Value>::splitOff()
+{
+    auto values=collect(0,slots_.size());
+    std::vector<Value> upper(values.begin()+values.size()/2,values.end());
+    values.erase(values.begin()+values.size()/2,values.end());
+    rebuild(std::move(values));
+    return GappedLeaf(std::move(upper));
+}
+template<typename Value>
+size_t GappedLeaf<Value>::findSlot(const Value &value) const
+{
+    size_t current=slots_.size();
+    size_t step=slots_.size();
+    while(step>0)
+    {
+        if(current<step || slots_[current-step]<value)
+            step/=2;
+        else
+            current-=step;
+    }
+    return current;
+}
+template<typename Value>
+void GappedLeaf<Value>::insertAt(size_t slot,const Value &value)
+{//the slot before is either used or a trailing gap
+    const auto capacity=slots_.size();
+    if(slot<capacity && !used_[slot])
+    {
+        slots_[slot]=value;
+        used_[slot]=true;
+        return;
+    }
+    if(slot==capacity && !used_[capacity-1])
+    {//appending after the largest value
+        auto gap=capacity-1;
+        while(!used_[gap-1])
+            --gap;
+        slots_[gap]=value;
+        used_[gap]=true;
+        fillTrailingGaps();
+        return;
+    }
+    const auto position=(slot<capacity?slot:capacity-1);
+    for(size_t windowSize=segmentSize;windowSize<=capacity;windowSize*=2)
+    {
+        const auto begin=position/windowSize*windowSize;
+        const auto end=begin+windowSize;
+        size_t count=0;
+        for(auto s=begin;s<end;++s)
+            count+=used_[s];
+        if(count+1>getMaxCount(windowSize))
+            continue;
+        if(windowSize==segmentSize)
+            shiftInsideSegment(slot,end,value);
+        else
+        {
+            auto values=collect(begin,slot);
+            values.push_back(value);
+            const auto upper=collect(slot,end);
+            values.insert(values.end(),upper.begin(),upper.end());
+            spread(std::move(values),begin,end);
+        }
+        return;
+    }
+    auto values=collect(0,slot);
+    values.push_back(value);
+    const auto upper=collect(slot,capacity);
+    values.insert(values.end(),upper.begin(),upper.end());
+    rebuild(std::move(values));
+}
+template<typename Value>
+void GappedLeaf<Value>::shiftInsideSegment(size_t slot,size_t segmentEnd,const Value &value)
+{
+    auto gap=slot;
+    while(gap<segmentEnd && used_[gap])
+        ++gap;
+    if(gap<segmentEnd)
+    {//values up to the gap move right, gaps after it keep copying the same next value
+        for(auto s=gap;s>slot;--s)
+            slots_[s]=slots_[s-1];
+        used_[gap]=true;
+        slots_[slot]=value;
+        return;
+    }
+    gap=slot-1;
+    while(used_[gap])
+        --gap;
+    for(auto s=gap;s+1<slot;++s)
+        slots_[s]=slots_[s+1];
+    used_[gap]=true;
+    slots_[slot-1]=value;
+}
+template<typename Value>
+void GappedLeaf<Value>::spread(std::vector<Value> &&sortedValues,size_t begin,size_t end)
+{
+    const auto windowSize=end-begin;
+    const auto count=sortedValues.size();
+    for(auto s=begin;s<end;++s)
+        used_[s]=false;
+    for(size_t index=0;index<count;++index)
+    {
+        const auto slot=begin+index*windowSize/count;
+        slots_[slot]=std::move(sortedValues[index]);
+        used_[slot]=true;
+    }
+    const bool isLast=(end==slots_.size() || !(slots_[begin+(count-1)*windowSize/count]<slots_[end]));
+    if(isLast)
+        fillTrailingGaps();
+    for(auto s=end;s>begin;--s)
+        if(s<slots_.size() && !used_[s-1])
+            slots_[s-1]=slots_[s];
+    fillGapsBefore(begin);
+}
+template<typename Value>
+void GappedLeaf<Value>::rebuild(std::vector<Value> &&sortedValues)
+{
+    size_=sortedValues.size();
+    size_t capacity=segmentSize;
+    while(capacity*5<size_*8)
+        capacity*=2;
+    if(size_==0)
+    {
+        slots_.clear();
+        used_.clear();
+        return;
+    }
+    slots_.assign(capacity,sortedValues.front());
+    used_.assign(capacity,false);
+    spread(std::move(sortedValues),0,capacity);
+}
+template<typename Value>
+void GappedLeaf<Value>::fillGapsBefore(size_t slot)
+{
+    for(auto s=slot;s>0 && !used_[s-1];--s)
+        slots_[s-1]=slots_[slot];
+}
+template<typename Value>
+void GappedLeaf<Value>::fillTrailingGaps()
+{//gaps after the largest value copy it, which keeps the array sorted
+    auto last=slots_.size()-1;
+    while(!used_[last])
+        --last;
+    for(auto s=last+1;s<slots_.size();++s)
+        slots_[s]=slots_[last];
+    fillGapsBefore(last);
+}
+template<typename Value>
+std::vector<Value> GappedLeaf<Value>::collect(size_t begin,size_t end) const
+{
+    std::vector<Value> values;
+    for(auto s=begin;s<end;++s)
+        if(used_[s])
+            values.push_back(slots_[s]);
+    return values;
+}
+template<typename Value>
+size_t GappedLeaf<Value>::getMaxCount(size_t windowSize) const
+{//a segment may get full, density allowed for wider windows goes down to 3/4 for the whole leaf
+    size_t levelCount=0;
+    while((segmentSize<<levelCount)<slots_.size())
+        ++levelCount;
+    if(levelCount==0)
+        return windowSize*3/4;
+    size_t level=0;
+    while((segmentSize<<level)<windowSize)
+        ++level;
+    return windowSize-windowSize*level/(4*levelCount);
+}
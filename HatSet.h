@@ -1,81 +1,341 @@
 #pragma once
+#include <algorithm>
 #include <functional>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
 #include <vector>
-template<typename Value>
+#include "Statistics.h"
+template<typename Value,typename Allocator=std::allocator<Value>,typename Statistics=NoStatistics>
 class HatSet
 {
 public:
     class Iterator;
-    HatSet(size_t minChunkSize,size_t maxChunkSize);
+    //with a non-zero splitStep a full chunk is split over the following writes, copying splitStep values per write,
+    //so no single operation pays for copying half a chunk
+    HatSet(size_t minChunkSize,size_t maxChunkSize,size_t splitStep=0);
     void insert(const Value&);
     void erase(const Value&);
+    //chunks inside [from,to) are dropped whole and only the two boundary chunks are trimmed,
+    //eraseIf repacks chunks with compact() when it erases anything;
+    //a pending split is abandoned by both of these, the chunk starts it again on its next insert
+    size_t eraseRange(const Value &from,const Value &to);//returns the number of erased values
+    size_t eraseIf(const std::function<bool(const Value&)>&);
     bool contains(const Value&) const;
     void enumerate(const std::function<void(const Value&)>&) const;
+    //values popped from the front of the first chunk are only skipped, the chunk is shifted when it's written to
+    //or merged, so popping the smallest values one by one costs amortized O(1); all of these throw on an empty container
+    const Value &min() const;
+    const Value &max() const;
+    Value popMin();
+    Value popMax();
+    void setChunkSizes(size_t minChunkSize,size_t maxChunkSize);//existing chunks follow on their next split
+    //a chunk which gets below minChunkSize is merged with a neighbour at once, these repack the rest:
+    void compact();//spreads values evenly over chunks of (minChunkSize+maxChunkSize)/2 values
+    void shrinkToFit();//releases spare capacity of chunks, values stay in their chunks
+    //merges neighbours which fit into (minChunkSize+maxChunkSize)/2 values and releases spare capacity,
+    //moving about budget values (at least one chunk is looked at) and continuing from where the previous call stopped;
+    //returns false once a whole pass over chunks found nothing to do
+    bool compactStep(size_t budget);
+    //chunks count as leaves; counters are process-wide, see Statistics::getCounters(),
+    //and a lookup counts the chunks whose first values it compares as visited
+    LeafFill statistics() const;
 private:
-    using Chunk=std::vector<Value>;
+    using Chunk=std::vector<Value,Allocator>;
+    using Chunks=std::vector<Chunk,typename std::allocator_traits<Allocator>::template rebind_alloc<Chunk>>;
     size_t minChunkSize_,maxChunkSize_;
-    std::vector<Chunk> chunks_;
+    Chunks chunks_;
+    size_t splitStep_;
+    bool isSplitPending_;
+    size_t splittingChunkIndex_;
+    size_t splitIndex_;//values of the splitting chunk from this index go to the new chunk
+    Chunk pendingChunk_;//copies of values of the splitting chunk starting from splitIndex_
+    size_t frontOffset_;//values of the first chunk before this index are popped already, it's 0 while the chunk is being split
+    size_t compactionIndex_;//the chunk the next compactStep starts from
+    bool hasCompactionPassChanged_;
     size_t findChunkIndex(const Value&) const;
     void splitChunkIfNeeded(size_t chunkIndex);
-    static size_t findIndexForValue(const Chunk&,const Value &value);//returns first element>=value
+    void continueSplit();
+    void onInserted(size_t chunkIndex,size_t index,const Value&);
+    void onErased(size_t chunkIndex,size_t index);
+    void rebalanceChunk(size_t chunkIndex);//erases an empty chunk and merges one below minChunkSize
+    void mergeChunks(size_t leftIndex);//neither of them may be the splitting one
+    bool isSplitting(size_t chunkIndex) const;
+    void shrinkChunk(size_t chunkIndex);
+    bool hasSpareCapacity(const Chunk&) const;
+    void dropPoppedValues();
+    void dropPendingChanges();//popped values are removed for real and a pending split is abandoned
+    size_t getFirstIndex(size_t chunkIndex) const;
+    size_t getChunkSize(size_t chunkIndex) const;//without popped values
+    size_t getTargetChunkSize() const;
+    size_t getChunkCapacity() const;
+    static size_t findIndexForValue(const Chunk&,size_t begin,const Value &value);//returns first element>=value starting from begin
 };
 ///////////////////////////////////////////////////////////////////////////////
-template<typename Value>
-HatSet<Value>::HatSet(size_t minChunkSize,size_t maxChunkSize)
+template<typename Value,typename Allocator,typename Statistics>
+HatSet<Value,Allocator,Statistics>::HatSet(size_t minChunkSize,size_t maxChunkSize,size_t splitStep)
     :minChunkSize_(minChunkSize)
     ,maxChunkSize_(maxChunkSize)
+    ,splitStep_(splitStep)
+    ,isSplitPending_(false)
+    ,splittingChunkIndex_(0)
+    ,splitIndex_(0)
+    ,frontOffset_(0)
+    ,compactionIndex_(0)
+    ,hasCompactionPassChanged_(false)
 {}
-template<typename Value>
-void HatSet<Value>::insert(const Value &value)
+template<typename Value,typename Allocator,typename Statistics>
+void HatSet<Value,Allocator,Statistics>::insert(const Value &value)
 {
+    Statistics::add(Counter::insertion);
     if(chunks_.empty())
     {
         chunks_.emplace_back();
+        chunks_.back().reserve(getChunkCapacity());
         chunks_.back().emplace_back(value);
         return;
     }
     const auto chunkIndex=findChunkIndex(value);
     auto &chunk=chunks_[chunkIndex];
-    const auto index=findIndexForValue(chunk,value);
+    const auto index=findIndexForValue(chunk,getFirstIndex(chunkIndex),value);
     if(index==chunk.size() || chunk[index]!=value)
     {
-        chunk.insert(chunk.begin()+index,value);
-        splitChunkIfNeeded(chunkIndex);
+        if(chunkIndex==0 && frontOffset_>0)
+        {//smaller values move into the popped part, the chunk doesn't grow
+            Statistics::add(Counter::movedValue,index-frontOffset_);
+            std::move(chunk.begin()+frontOffset_,chunk.begin()+index,chunk.begin()+frontOffset_-1);
+            --frontOffset_;
+            chunk[index-1]=value;
+        }
+        else
+        {
+            Statistics::add(Counter::movedValue,chunk.size()-index);
+            chunk.insert(chunk.begin()+index,value);
+            onInserted(chunkIndex,index,value);
+            splitChunkIfNeeded(chunkIndex);
+        }
     }
+    continueSplit();
 }
-template<typename Value>
-void HatSet<Value>::erase(const Value &value)
+template<typename Value,typename Allocator,typename Statistics>
+void HatSet<Value,Allocator,Statistics>::erase(const Value &value)
 {
     if(chunks_.empty())
         return;
     const auto chunkIndex=findChunkIndex(value);
     auto &chunk=chunks_[chunkIndex];
-    const auto index=findIndexForValue(chunk,value);
+    const auto index=findIndexForValue(chunk,getFirstIndex(chunkIndex),value);
     if(index<chunk.size() && chunk[index]==value)
     {
         chunk.erase(chunk.begin()+index);
-        if(chunk.empty())
-            chunks_.erase(chunks_.begin()+chunkIndex);
+        onErased(chunkIndex,index);
+        rebalanceChunk(chunkIndex);
+    }
+    continueSplit();
+}
+template<typename Value,typename Allocator,typename Statistics>
+size_t HatSet<Value,Allocator,Statistics>::eraseRange(const Value &from,const Value &to)
+{
+    if(chunks_.empty() || !(from<to))
+        return 0;
+    const auto lowerBound=from,upperBound=to;//the arguments may refer to values of this container
+    dropPendingChanges();
+    const auto firstChunkIndex=findChunkIndex(lowerBound);
+    const auto lastChunkIndex=findChunkIndex(upperBound);
+    auto &firstChunk=chunks_[firstChunkIndex];
+    auto &lastChunk=chunks_[lastChunkIndex];
+    const auto begin=findIndexForValue(firstChunk,0,lowerBound);
+    const auto end=findIndexForValue(lastChunk,0,upperBound);
+    size_t count=0;
+    if(firstChunkIndex==lastChunkIndex)
+    {
+        count=end-begin;
+        firstChunk.erase(firstChunk.begin()+begin,firstChunk.begin()+end);
+    }
+    else
+    {
+        count=firstChunk.size()-begin+end;
+        for(auto chunkIndex=firstChunkIndex+1;chunkIndex<lastChunkIndex;++chunkIndex)
+            count+=chunks_[chunkIndex].size();
+        firstChunk.erase(firstChunk.begin()+begin,firstChunk.end());
+        lastChunk.erase(lastChunk.begin(),lastChunk.begin()+end);
+        chunks_.erase(chunks_.begin()+firstChunkIndex+1,chunks_.begin()+lastChunkIndex);
+        rebalanceChunk(firstChunkIndex+1);
+    }
+    rebalanceChunk(firstChunkIndex);
+    return count;
+}
+template<typename Value,typename Allocator,typename Statistics>
+size_t HatSet<Value,Allocator,Statistics>::eraseIf(const std::function<bool(const Value&)> &predicate)
+{
+    dropPendingChanges();
+    size_t count=0;
+    for(auto &chunk:chunks_)
+    {
+        const auto end=std::remove_if(chunk.begin(),chunk.end(),predicate);
+        count+=size_t(chunk.end()-end);
+        chunk.erase(end,chunk.end());
     }
+    if(count>0)
+        compact();
+    return count;
 }
-template<typename Value>
-bool HatSet<Value>::contains(const Value &value) const
+template<typename Value,typename Allocator,typename Statistics>
+bool HatSet<Value,Allocator,Statistics>::contains(const Value &value) const
 {
+    Statistics::add(Counter::lookup);
     if(chunks_.empty())
         return false;
-    const auto &chunk=chunks_[findChunkIndex(value)];
-    const auto index=findIndexForValue(chunk,value);
+    const auto chunkIndex=findChunkIndex(value);
+    Statistics::add(Counter::visitedNode,chunkIndex+1);
+    const auto &chunk=chunks_[chunkIndex];
+    const auto index=findIndexForValue(chunk,getFirstIndex(chunkIndex),value);
     return (index<chunk.size() && chunk[index]==value);
 }
-template<typename Value>
-void HatSet<Value>::enumerate(const std::function<void(const Value&)> &processor) const
+template<typename Value,typename Allocator,typename Statistics>
+void HatSet<Value,Allocator,Statistics>::enumerate(const std::function<void(const Value&)> &processor) const
+{
+    for(size_t chunkIndex=0;chunkIndex<chunks_.size();++chunkIndex)
+    {
+        const auto &chunk=chunks_[chunkIndex];
+        for(auto index=getFirstIndex(chunkIndex);index<chunk.size();++index)
+            processor(chunk[index]);
+    }
+}
+template<typename Value,typename Allocator,typename Statistics>
+const Value &HatSet<Value,Allocator,Statistics>::min() const
 {
+    if(chunks_.empty())
+        throw std::logic_error("the container is empty");
+    return chunks_.front()[frontOffset_];
+}
+template<typename Value,typename Allocator,typename Statistics>
+const Value &HatSet<Value,Allocator,Statistics>::max() const
+{
+    if(chunks_.empty())
+        throw std::logic_error("the container is empty");
+    return chunks_.back().back();
+}
+template<typename Value,typename Allocator,typename Statistics>
+Value HatSet<Value,Allocator,Statistics>::popMin()
+{
+    if(chunks_.empty())
+        throw std::logic_error("the container is empty");
+    auto &chunk=chunks_.front();
+    auto value=std::move(chunk[frontOffset_]);
+    if(isSplitPending_ && splittingChunkIndex_==0)
+    {//the split copies values by their indices, so the chunk is shifted as on erase
+        chunk.erase(chunk.begin());
+        onErased(0,0);
+    }
+    else
+        ++frontOffset_;
+    rebalanceChunk(0);
+    continueSplit();
+    return value;
+}
+template<typename Value,typename Allocator,typename Statistics>
+Value HatSet<Value,Allocator,Statistics>::popMax()
+{
+    if(chunks_.empty())
+        throw std::logic_error("the container is empty");
+    const auto chunkIndex=chunks_.size()-1;
+    auto &chunk=chunks_.back();
+    auto value=std::move(chunk.back());
+    chunk.pop_back();
+    onErased(chunkIndex,chunk.size());
+    rebalanceChunk(chunkIndex);
+    continueSplit();
+    return value;
+}
+template<typename Value,typename Allocator,typename Statistics>
+void HatSet<Value,Allocator,Statistics>::setChunkSizes(size_t minChunkSize,size_t maxChunkSize)
+{
+    minChunkSize_=minChunkSize;
+    maxChunkSize_=maxChunkSize;
+}
+template<typename Value,typename Allocator,typename Statistics>
+LeafFill HatSet<Value,Allocator,Statistics>::statistics() const
+{
+    LeafFill fill;
+    for(size_t chunkIndex=0;chunkIndex<chunks_.size();++chunkIndex)
+        fill.addLeaf(chunks_[chunkIndex].size()-getFirstIndex(chunkIndex),maxChunkSize_);
+    return fill;
+}
+template<typename Value,typename Allocator,typename Statistics>
+void HatSet<Value,Allocator,Statistics>::compact()
+{
+    dropPendingChanges();
+    size_t count=0;
     for(const auto &chunk:chunks_)
-        for(const auto &value:chunk)
-            processor(value);
+        count+=chunk.size();
+    const auto targetSize=getTargetChunkSize();
+    const auto chunkCount=(count+targetSize-1)/targetSize;
+    const auto getSize=[&](size_t chunkIndex){return count/chunkCount+(chunkIndex<count%chunkCount?1:0);};
+    Chunks chunks;
+    chunks.reserve(chunkCount);
+    for(auto &chunk:chunks_)
+    {
+        for(auto &value:chunk)
+        {
+            if(chunks.empty() || chunks.back().size()==getSize(chunks.size()-1))
+            {
+                chunks.emplace_back();
+                chunks.back().reserve(std::max(getSize(chunks.size()-1),getChunkCapacity()));
+            }
+            chunks.back().push_back(std::move(value));
+        }
+        Chunk().swap(chunk);//memory of old chunks goes as soon as they are moved
+    }
+    chunks_=std::move(chunks);
+    compactionIndex_=0;
+}
+template<typename Value,typename Allocator,typename Statistics>
+void HatSet<Value,Allocator,Statistics>::shrinkToFit()
+{
+    for(size_t chunkIndex=0;chunkIndex<chunks_.size();++chunkIndex)
+        if(hasSpareCapacity(chunks_[chunkIndex]))
+            shrinkChunk(chunkIndex);
+    chunks_.shrink_to_fit();
+}
+template<typename Value,typename Allocator,typename Statistics>
+bool HatSet<Value,Allocator,Statistics>::compactStep(size_t budget)
+{
+    size_t work=0;
+    while(work<std::max<size_t>(budget,1))
+    {//a zero budget still looks at one chunk, so calling this until it returns false always ends
+        if(compactionIndex_>=chunks_.size())
+        {//a pass is over
+            compactionIndex_=0;
+            if(!hasCompactionPassChanged_)
+                return false;
+            hasCompactionPassChanged_=false;
+            continue;
+        }
+        const auto chunkIndex=compactionIndex_;
+        ++work;//for looking at the chunk
+        if(chunkIndex+1<chunks_.size()
+            && !isSplitting(chunkIndex)
+            && !isSplitting(chunkIndex+1)
+            && getChunkSize(chunkIndex)+getChunkSize(chunkIndex+1)<=getTargetChunkSize())
+        {//the chunk stays where it is, so that it can take the next one as well
+            work+=chunks_[chunkIndex+1].size();
+            mergeChunks(chunkIndex);
+            hasCompactionPassChanged_=true;
+            continue;
+        }
+        if(hasSpareCapacity(chunks_[chunkIndex]))
+        {
+            work+=chunks_[chunkIndex].size();
+            shrinkChunk(chunkIndex);
+            hasCompactionPassChanged_=true;
+        }
+        ++compactionIndex_;
+    }
+    return true;
 }
-template<typename Value>
-size_t HatSet<Value>::findChunkIndex(const Value &value) const
+template<typename Value,typename Allocator,typename Statistics>
+size_t HatSet<Value,Allocator,Statistics>::findChunkIndex(const Value &value) const
 {
     size_t index=0;
     while(index+1<chunks_.size())
@@ -87,11 +347,26 @@ size_t HatSet<Value>::findChunkIndex(const Value &value) const
     }
     return index;
 }
-template<typename Value>
-void HatSet<Value>::splitChunkIfNeeded(size_t chunkIndex)
+template<typename Value,typename Allocator,typename Statistics>
+void HatSet<Value,Allocator,Statistics>::splitChunkIfNeeded(size_t chunkIndex)
 {
-    if(chunks_[chunkIndex].size()>maxChunkSize_)
+    if(chunks_[chunkIndex].size()<=maxChunkSize_)
+        return;
+    if(splitStep_>0)
+    {//another chunk being split already makes this one wait for its turn
+        if(!isSplitPending_)
+        {
+            isSplitPending_=true;
+            splittingChunkIndex_=chunkIndex;
+            splitIndex_=chunks_[chunkIndex].size()/2;
+            pendingChunk_.clear();
+            pendingChunk_.reserve(getChunkCapacity());
+        }
+    }
+    else
     {
+        Statistics::add(Counter::split);
+        Statistics::add(Counter::movedValue,chunks_[chunkIndex].size()-chunks_[chunkIndex].size()/2);
         chunks_.emplace(chunks_.begin()+chunkIndex+1);
         auto &source=chunks_[chunkIndex];
         auto &destination=chunks_[chunkIndex+1];
@@ -99,14 +374,156 @@ void HatSet<Value>::splitChunkIfNeeded(size_t chunkIndex)
         source.erase(source.begin()+source.size()/2,source.end());
     }
 }
-template<typename Value>
-size_t HatSet<Value>::findIndexForValue(const Chunk &chunk,const Value &value)
+template<typename Value,typename Allocator,typename Statistics>
+void HatSet<Value,Allocator,Statistics>::continueSplit()
+{
+    if(!isSplitPending_)
+        return;
+    auto &chunk=chunks_[splittingChunkIndex_];
+    const auto begin=splitIndex_+pendingChunk_.size();
+    const auto end=std::min(chunk.size(),begin+splitStep_);
+    Statistics::add(Counter::movedValue,end-begin);
+    pendingChunk_.insert(pendingChunk_.end(),chunk.begin()+begin,chunk.begin()+end);
+    if(end<chunk.size())
+        return;
+    isSplitPending_=false;
+    if(splitIndex_==0)
+    {//the lower half was erased in the meantime, nothing to split
+        pendingChunk_.clear();
+        return;
+    }
+    Statistics::add(Counter::split);
+    chunk.erase(chunk.begin()+splitIndex_,chunk.end());
+    chunks_.insert(chunks_.begin()+splittingChunkIndex_+1,std::move(pendingChunk_));
+    pendingChunk_=Chunk();
+}
+template<typename Value,typename Allocator,typename Statistics>
+void HatSet<Value,Allocator,Statistics>::onInserted(size_t chunkIndex,size_t index,const Value &value)
+{//keeps the copied part of the splitting chunk in sync
+    if(!isSplitPending_ || chunkIndex!=splittingChunkIndex_)
+        return;
+    if(index<splitIndex_)
+        ++splitIndex_;
+    else if(index-splitIndex_<pendingChunk_.size())
+        pendingChunk_.insert(pendingChunk_.begin()+(index-splitIndex_),value);
+}
+template<typename Value,typename Allocator,typename Statistics>
+void HatSet<Value,Allocator,Statistics>::onErased(size_t chunkIndex,size_t index)
+{
+    if(!isSplitPending_ || chunkIndex!=splittingChunkIndex_)
+        return;
+    if(index<splitIndex_)
+        --splitIndex_;
+    else if(index-splitIndex_<pendingChunk_.size())
+        pendingChunk_.erase(pendingChunk_.begin()+(index-splitIndex_));
+}
+template<typename Value,typename Allocator,typename Statistics>
+void HatSet<Value,Allocator,Statistics>::rebalanceChunk(size_t chunkIndex)
+{
+    const auto size=getChunkSize(chunkIndex);
+    if(size>0)
+    {
+        if(size>=minChunkSize_ || chunks_.size()<2)
+            return;
+        auto leftIndex=chunkIndex;
+        if(chunkIndex+1==chunks_.size())
+            --leftIndex;
+        else if(chunkIndex>0 && getChunkSize(chunkIndex-1)<getChunkSize(chunkIndex+1))
+            --leftIndex;
+        if(isSplitting(leftIndex) || isSplitting(leftIndex+1))
+            return;//the splitting chunk is big, the small one waits for the next erase after the split
+        mergeChunks(leftIndex);
+        splitChunkIfNeeded(leftIndex);
+        return;
+    }
+    chunks_.erase(chunks_.begin()+chunkIndex);
+    if(chunkIndex==0)
+        frontOffset_=0;
+    if(isSplitPending_ && chunkIndex==splittingChunkIndex_)
+        isSplitPending_=false;
+    else if(isSplitPending_ && chunkIndex<splittingChunkIndex_)
+        --splittingChunkIndex_;
+}
+template<typename Value,typename Allocator,typename Statistics>
+void HatSet<Value,Allocator,Statistics>::mergeChunks(size_t leftIndex)
+{//the merged chunk may exceed maxChunkSize, then the caller splits it
+    Statistics::add(Counter::merge);
+    if(leftIndex==0)
+        dropPoppedValues();
+    auto &left=chunks_[leftIndex];
+    auto &right=chunks_[leftIndex+1];
+    left.insert(left.end(),std::make_move_iterator(right.begin()),std::make_move_iterator(right.end()));
+    chunks_.erase(chunks_.begin()+leftIndex+1);
+    if(isSplitPending_ && splittingChunkIndex_>leftIndex)
+        --splittingChunkIndex_;
+}
+template<typename Value,typename Allocator,typename Statistics>
+bool HatSet<Value,Allocator,Statistics>::isSplitting(size_t chunkIndex) const
+{
+    return isSplitPending_ && chunkIndex==splittingChunkIndex_;
+}
+template<typename Value,typename Allocator,typename Statistics>
+void HatSet<Value,Allocator,Statistics>::shrinkChunk(size_t chunkIndex)
+{//capacity reserved for incremental splits is kept
+    auto &chunk=chunks_[chunkIndex];
+    Chunk shrunk;
+    shrunk.reserve(std::max(chunk.size(),getChunkCapacity()));
+    shrunk.assign(std::make_move_iterator(chunk.begin()),std::make_move_iterator(chunk.end()));
+    chunk.swap(shrunk);
+}
+template<typename Value,typename Allocator,typename Statistics>
+bool HatSet<Value,Allocator,Statistics>::hasSpareCapacity(const Chunk &chunk) const
+{//growth of a vector leaves up to a half of it unused, a quarter is tolerated
+    return chunk.capacity()>std::max(chunk.size()+chunk.size()/4,getChunkCapacity());
+}
+template<typename Value,typename Allocator,typename Statistics>
+void HatSet<Value,Allocator,Statistics>::dropPoppedValues()
+{
+    if(frontOffset_==0)
+        return;
+    chunks_.front().erase(chunks_.front().begin(),chunks_.front().begin()+frontOffset_);
+    frontOffset_=0;
+}
+template<typename Value,typename Allocator,typename Statistics>
+void HatSet<Value,Allocator,Statistics>::dropPendingChanges()
+{
+    dropPoppedValues();
+    if(isSplitPending_)
+    {
+        isSplitPending_=false;
+        pendingChunk_=Chunk();
+    }
+}
+template<typename Value,typename Allocator,typename Statistics>
+size_t HatSet<Value,Allocator,Statistics>::getFirstIndex(size_t chunkIndex) const
+{
+    return (chunkIndex==0?frontOffset_:0);
+}
+template<typename Value,typename Allocator,typename Statistics>
+size_t HatSet<Value,Allocator,Statistics>::getChunkSize(size_t chunkIndex) const
+{
+    return chunks_[chunkIndex].size()-getFirstIndex(chunkIndex);
+}
+template<typename Value,typename Allocator,typename Statistics>
+size_t HatSet<Value,Allocator,Statistics>::getTargetChunkSize() const
+{
+    return std::max<size_t>((minChunkSize_+maxChunkSize_)/2,1);
+}
+template<typename Value,typename Allocator,typename Statistics>
+size_t HatSet<Value,Allocator,Statistics>::getChunkCapacity() const
+{//room for values inserted while the chunk waits for its split, so that it doesn't reallocate
+    if(splitStep_==0)
+        return 0;
+    return maxChunkSize_+maxChunkSize_/splitStep_+1;
+}
+template<typename Value,typename Allocator,typename Statistics>
+size_t HatSet<Value,Allocator,Statistics>::findIndexForValue(const Chunk &chunk,size_t begin,const Value &value)
 {
     size_t current=chunk.size();
-    size_t step=chunk.size();
+    size_t step=chunk.size()-begin;
     while(step>0)
     {
-        if(current<step || chunk[current-step]<value)
+        if(current-begin<step || chunk[current-step]<value)
             step/=2;
         else
             current-=step;
@@ -0,0 +1,273 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <new>
+#include <vector>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+//where memory goes on machines with several NUMA nodes
+enum class NumaPlacement
+{
+    any,//whatever the OS does by default
+    interleaved,//pages are spread over all nodes, so that lookups from any socket see the same average latency
+    local//memory comes from the node of the allocating thread, e.g. the owner of a shard
+};
+//hands out blocks carved from 2 MiB pages, so that a big container needs far fewer TLB entries;
+//explicit huge pages must be reserved by the administrator (vm.nr_hugepages on Linux,
+//"Lock pages in memory" privilege on Windows), without them the arena falls back to transparent huge pages (Linux only);
+//freed blocks are kept for reuse, pages are never returned to the OS
+class HugePageArena
+{
+public:
+    static const size_t hugePageSize=size_t(2)<<20;
+    HugePageArena(NumaPlacement,bool explicitHugePages);
+    void* allocate(size_t bytes);
+    void deallocate(void*,size_t bytes);
+private:
+    static const size_t minBlockSize=16;
+    struct NodeArena
+    {
+        std::vector<std::vector<void*>> freeBlocks_;//by size class, block sizes are powers of 2
+        char *current_=nullptr;
+        size_t left_=0;
+    };
+    std::mutex mutex_;
+    NumaPlacement placement_;
+    bool explicitHugePages_;
+    std::vector<NodeArena> nodes_;//a single one unless placement is local
+    std::map<std::uintptr_t,size_t> pageNodes_;//start of a page -> its index in nodes_, only for local placement
+    size_t mappingCount_;
+    size_t getNodeIndex() const;
+    void* map(size_t bytes,size_t nodeIndex);
+    static void unmap(void*,size_t bytes);
+    static size_t getSizeClass(size_t bytes);
+    static size_t roundToPages(size_t bytes);
+};
+template<NumaPlacement placement,bool explicitHugePages>
+HugePageArena &getHugePageArena();//one per placement, shared by allocators of all value types
+//standard allocator for containers of values; stateless, all allocators with the same parameters share one arena
+template<typename Value,NumaPlacement placement=NumaPlacement::any,bool explicitHugePages=false>
+class HugePageAllocator
+{
+public:
+    using value_type=Value;
+    template<typename Other>
+    struct rebind
+    {
+        using other=HugePageAllocator<Other,placement,explicitHugePages>;
+    };
+    HugePageAllocator()=default;
+    template<typename Other>
+    HugePageAllocator(const HugePageAllocator<Other,placement,explicitHugePages>&);
+    Value* allocate(size_t count);
+    void deallocate(Value*,size_t count);
+};
+template<typename Value,typename Other,NumaPlacement placement,bool explicitHugePages>
+bool operator==(const HugePageAllocator<Value,placement,explicitHugePages>&,const HugePageAllocator<Other,placement,explicitHugePages>&);
+template<typename Value,typename Other,NumaPlacement placement,bool explicitHugePages>
+bool operator!=(const HugePageAllocator<Value,placement,explicitHugePages>&,const HugePageAllocator<Other,placement,explicitHugePages>&);
+///////////////////////////////////////////////////////////////////////////////
+inline HugePageArena::HugePageArena(NumaPlacement placement,bool explicitHugePages)
+    :placement_(placement)
+    ,explicitHugePages_(explicitHugePages)
+    ,mappingCount_(0)
+{}
+inline void* HugePageArena::allocate(size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto nodeIndex=getNodeIndex();
+    if(bytes>hugePageSize/2)
+        return map(roundToPages(bytes),nodeIndex);
+    const auto sizeClass=getSizeClass(bytes);
+    const auto blockSize=minBlockSize<<sizeClass;
+    if(nodes_.size()<=nodeIndex)
+        nodes_.resize(nodeIndex+1);
+    auto &node=nodes_[nodeIndex];
+    if(node.freeBlocks_.size()<=sizeClass)
+        node.freeBlocks_.resize(sizeClass+1);
+    auto &freeBlocks=node.freeBlocks_[sizeClass];
+    if(!freeBlocks.empty())
+    {
+        const auto block=freeBlocks.back();
+        freeBlocks.pop_back();
+        return block;
+    }
+    if(node.left_<blockSize)
+    {//the rest of the page goes to free lists in the largest blocks which fit
+        while(node.left_>=minBlockSize)
+        {
+            auto restClass=getSizeClass(node.left_);
+            if((minBlockSize<<restClass)>node.left_)
+                --restClass;
+            const auto restSize=minBlockSize<<restClass;
+            if(node.freeBlocks_.size()<=restClass)
+                node.freeBlocks_.resize(restClass+1);
+            node.freeBlocks_[restClass].push_back(node.current_);
+            node.current_+=restSize;
+            node.left_-=restSize;
+        }
+        node.current_=static_cast<char*>(map(hugePageSize,nodeIndex));
+        node.left_=hugePageSize;
+    }
+    const auto block=node.current_;
+    node.current_+=blockSize;
+    node.left_-=blockSize;
+    return block;
+}
+inline void HugePageArena::deallocate(void *block,size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(bytes>hugePageSize/2)
+    {
+        pageNodes_.erase(reinterpret_cast<std::uintptr_t>(block));
+        unmap(block,roundToPages(bytes));
+        return;
+    }
+    size_t nodeIndex=0;
+    if(placement_==NumaPlacement::local)
+        nodeIndex=std::prev(pageNodes_.upper_bound(reinterpret_cast<std::uintptr_t>(block)))->second;
+    nodes_[nodeIndex].freeBlocks_[getSizeClass(bytes)].push_back(block);
+}
+inline size_t HugePageArena::getNodeIndex() const
+{
+    if(placement_!=NumaPlacement::local)
+        return 0;
+#ifdef _WIN32
+    PROCESSOR_NUMBER processor;
+    GetCurrentProcessorNumberEx(&processor);
+    USHORT node=0;
+    GetNumaProcessorNodeEx(&processor,&node);
+    return node;
+#else
+    unsigned cpu=0,node=0;
+    if(syscall(SYS_getcpu,&cpu,&node,nullptr)!=0)
+        return 0;
+    return node;
+#endif
+}
+inline void* HugePageArena::map(size_t bytes,size_t nodeIndex)
+{
+    void *memory=nullptr;
+#ifdef _WIN32
+    ULONG node=NUMA_NO_PREFERRED_NODE;
+    if(placement_==NumaPlacement::local)
+        node=ULONG(nodeIndex);
+    else if(placement_==NumaPlacement::interleaved)
+    {//Windows has no interleaving policy, whole mappings go to nodes in turn
+        ULONG highestNode=0;
+        GetNumaHighestNodeNumber(&highestNode);
+        node=ULONG(mappingCount_%(highestNode+1));
+    }
+    if(explicitHugePages_)
+        memory=VirtualAllocExNuma(GetCurrentProcess(),nullptr,bytes,MEM_RESERVE|MEM_COMMIT|MEM_LARGE_PAGES,PAGE_READWRITE,node);
+    if(memory==nullptr)
+        memory=VirtualAllocExNuma(GetCurrentProcess(),nullptr,bytes,MEM_RESERVE|MEM_COMMIT,PAGE_READWRITE,node);
+    if(memory==nullptr)
+        throw std::bad_alloc();
+#else
+    if(explicitHugePages_)
+    {
+        memory=mmap(nullptr,bytes,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB,-1,0);
+        if(memory==MAP_FAILED)
+            memory=nullptr;
+    }
+    if(memory==nullptr)
+    {//transparent huge pages back only aligned ranges, so the mapping is trimmed to the huge page boundary
+        const auto raw=mmap(nullptr,bytes+hugePageSize,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+        if(raw==MAP_FAILED)
+            throw std::bad_alloc();
+        const auto rawStart=reinterpret_cast<std::uintptr_t>(raw);
+        const auto start=(rawStart+hugePageSize-1)/hugePageSize*hugePageSize;
+        if(start>rawStart)
+            munmap(raw,start-rawStart);
+        if(rawStart+hugePageSize>start)
+            munmap(reinterpret_cast<void*>(start+bytes),rawStart+hugePageSize-start);
+        memory=reinterpret_cast<void*>(start);
+#ifdef MADV_HUGEPAGE
+        madvise(memory,bytes,MADV_HUGEPAGE);
+#endif
+    }
+    {//the policy has to be set before pages are touched; it fails harmlessly without NUMA support
+        const int preferredPolicy=1,interleavePolicy=3;//MPOL_PREFERRED and MPOL_INTERLEAVE
+        int policy=0;
+        unsigned long nodeMask=0;
+        if(placement_==NumaPlacement::interleaved)
+        {
+            policy=interleavePolicy;
+            nodeMask=~0ul;
+        }
+        else if(placement_==NumaPlacement::local && nodeIndex<sizeof(nodeMask)*8)
+        {
+            policy=preferredPolicy;
+            nodeMask=1ul<<nodeIndex;
+        }
+        if(policy!=0)
+            syscall(SYS_mbind,memory,bytes,policy,&nodeMask,sizeof(nodeMask)*8+1,0);
+    }
+#endif
+    ++mappingCount_;
+    if(placement_==NumaPlacement::local)
+        pageNodes_[reinterpret_cast<std::uintptr_t>(memory)]=nodeIndex;
+    return memory;
+}
+inline void HugePageArena::unmap(void *memory,size_t bytes)
+{
+#ifdef _WIN32
+    (void)bytes;
+    VirtualFree(memory,0,MEM_RELEASE);
+#else
+    munmap(memory,bytes);
+#endif
+}
+inline size_t HugePageArena::getSizeClass(size_t bytes)
+{
+    size_t sizeClass=0;
+    while((minBlockSize<<sizeClass)<bytes)
+        ++sizeClass;
+    return sizeClass;
+}
+inline size_t HugePageArena::roundToPages(size_t bytes)
+{
+    return (bytes+hugePageSize-1)/hugePageSize*hugePageSize;
+}
+template<NumaPlacement placement,bool explicitHugePages>
+HugePageArena &getHugePageArena()
+{//never destroyed: containers with static storage duration may free their memory after it otherwise
+    static auto arena=new HugePageArena(placement,explicitHugePages);
+    return *arena;
+}
+template<typename Value,NumaPlacement placement,bool explicitHugePages>
+template<typename Other>
+HugePageAllocator<Value,placement,explicitHugePages>::HugePageAllocator(const HugePageAllocator<Other,placement,explicitHugePages>&)
+{}
+template<typename Value,NumaPlacement placement,bool explicitHugePages>
+Value* HugePageAllocator<Value,placement,explicitHugePages>::allocate(size_t count)
+{
+    return static_cast<Value*>(getHugePageArena<placement,explicitHugePages>().allocate(count*sizeof(Value)));
+}
+template<typename Value,NumaPlacement placement,bool explicitHugePages>
+void HugePageAllocator<Value,placement,explicitHugePages>::deallocate(Value *values,size_t count)
+{
+    getHugePageArena<placement,explicitHugePages>().deallocate(values,count*sizeof(Value));
+}
+template<typename Value,typename Other,NumaPlacement placement,bool explicitHugePages>
+bool operator==(const HugePageAllocator<Value,placement,explicitHugePages>&,const HugePageAllocator<Other,placement,explicitHugePages>&)
+{
+    return true;
+}
+template<typename Value,typename Other,NumaPlacement placement,bool explicitHugePages>
+bool operator!=(const HugePageAllocator<Value,placement,explicitHugePages>&,const HugePageAllocator<Other,placement,explicitHugePages>&)
+{
+    return false;
+}
@@ -0,0 +1,243 @@
+#pragma once
+#include "BTree.h"
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <type_traits>
+#include <vector>
+//read-mostly set of integers: values are kept in one sorted array, and instead of inner nodes a few levels
+//of piecewise linear models predict the position of a value with an error of at most maxError,
+//so a lookup is a couple of short local searches (as in the PGM index);
+//writes go to small B-trees of inserted and erased values, which are merged into the array once they grow
+//to 1/deltaShare of it, the models are fitted again then
+template<typename Value>
+class LearnedIndexSet
+{
+    static_assert(std::is_integral<Value>::value,"models are fitted to integer keys");
+public:
+    class Iterator;
+    explicit LearnedIndexSet(size_t maxError=16,size_t deltaShare=8);
+    void insert(const Value&);
+    void erase(const Value&);
+    bool contains(const Value&) const;
+    void enumerate(const std::function<void(const Value&)>&) const;
+    void compact();//merges pending writes into the array
+private:
+    static const size_t minDeltaSize=256;//small arrays are not refitted on every few writes
+    static const size_t deltaMinChunkSize=32,deltaMaxChunkSize=63;
+    struct Segment
+    {//predicts positions of values starting from key_ as position_+slope_*(value-key_)
+        Value key_;
+        double slope_;
+        size_t position_;
+    };
+    using Segments=std::vector<Segment>;
+    size_t maxError_;
+    size_t deltaShare_;
+    std::vector<Value> values_;
+    std::vector<Segments> levels_;//the first one is fitted to values_, each next one to keys of the previous one
+    BTree<Value> inserted_,erased_;//inserted_ holds only values absent in values_, erased_ only present ones
+    size_t deltaSize_;
+    void mergeIfNeeded();
+    void fit();
+    bool containsInArray(const Value&) const;
+    size_t findIndexForValue(const Value&) const;//returns first element of values_>=value
+    void predict(const Segments&,size_t segmentIndex,size_t count,const Value&,size_t &begin,size_t &end) const;
+    static Segments fit(const std::vector<Value> &keys,size_t maxError);
+    static double getDistance(const Value &from,const Value &to);//to>=from
+    static std::vector<Value> collect(const BTree<Value>&);
+};
+///////////////////////////////////////////////////////////////////////////////
+template<typename Value>
+LearnedIndexSet<Value>::LearnedIndexSet(size_t maxError,size_t deltaShare)
+    :maxError_(maxError)
+    ,deltaShare_(deltaShare)
+    ,inserted_(deltaMinChunkSize,deltaMaxChunkSize)
+    ,erased_(deltaMinChunkSize,deltaMaxChunkSize)
+    ,deltaSize_(0)
+{}
+template<typename Value>
+void LearnedIndexSet<Value>::insert(const Value &value)
+{
+    if(containsInArray(value))
+    {
+        if(!erased_.contains(value))
+            return;
+        erased_.erase(value);
+        --deltaSize_;
+        return;
+    }
+    if(inserted_.contains(value))
+        return;
+    inserted_.insert(value);
+    ++deltaSize_;
+    mergeIfNeeded();
+}
+template<typename Value>
+void LearnedIndexSet<Value>::erase(const Value &value)
+{
+    if(containsInArray(value))
+    {
+        if(erased_.contains(value))
+            return;
+        erased_.insert(value);
+        ++deltaSize_;
+        mergeIfNeeded();
+        return;
+    }
+    if(!inserted_.contains(value))
+        return;
+    inserted_.erase(value);
+    --deltaSize_;
+}
+template<typename Value>
+bool LearnedIndexSet<Value>::contains(const Value &value) const
+{
+    if(deltaSize_==0)
+        return containsInArray(value);
+    if(containsInArray(value))
+        return !erased_.contains(value);
+    return inserted_.contains(value);
+}
+template<typename Value>
+void LearnedIndexSet<Value>::enumerate(const std::function<void(const Value&)> &processor) const
+{
+    const auto inserted=collect(inserted_);
+    const auto erased=collect(erased_);
+    auto insertedValue=inserted.begin();
+    auto erasedValue=erased.begin();
+    for(const auto &value:values_)
+    {
+        for(;insertedValue!=inserted.end() && *insertedValue<value;++insertedValue)
+            processor(*insertedValue);
+        if(erasedValue!=erased.end() && *erasedValue==value)
+            ++erasedValue;
+        else
+            processor(value);
+    }
+    for(;insertedValue!=inserted.end();++insertedValue)
+        processor(*insertedValue);
+}
+template<typename Value>
+void LearnedIndexSet<Value>::compact()
+{
+    if(deltaSize_==0)
+        return;
+    std::vector<Value> values;
+    values.reserve(values_.size()+deltaSize_);
+    enumerate([&](const Value &value){values.push_back(value);});
+    values_=std::move(values);
+    inserted_=BTree<Value>(deltaMinChunkSize,deltaMaxChunkSize);
+    erased_=BTree<Value>(deltaMinChunkSize,deltaMaxChunkSize);
+    deltaSize_=0;
+    fit();
+}
+template<typename Value>
+void LearnedIndexSet<Value>::mergeIfNeeded()
+{
+    if(deltaSize_>std::max(size_t(minDeltaSize),values_.size()/deltaShare_))
+        compact();
+}
+template<typename Value>
+void LearnedIndexSet<Value>::fit()
+{
+    levels_.clear();
+    if(values_.empty())
+        return;
+    levels_.push_back(fit(values_,maxError_));
+    while(levels_.back().size()>1)
+    {
+        std::vector<Value> keys;
+        keys.reserve(levels_.back().size());
+        for(const auto &segment:levels_.back())
+            keys.push_back(segment.key_);
+        levels_.push_back(fit(keys,maxError_));
+    }
+}
+template<typename Value>
+bool LearnedIndexSet<Value>::containsInArray(const Value &value) const
+{
+    const auto index=findIndexForValue(value);
+    return index<values_.size() && values_[index]==value;
+}
+template<typename Value>
+size_t LearnedIndexSet<Value>::findIndexForValue(const Value &value) const
+{
+    if(values_.empty())
+        return 0;
+    size_t segmentIndex=0;
+    size_t begin,end;
+    for(auto level=levels_.size()-1;level>0;--level)
+    {//the last segment below with key<=value, or the first one if there is no such segment
+        const auto &lower=levels_[level-1];
+        predict(levels_[level],segmentIndex,lower.size(),value,begin,end);
+        const auto next=std::upper_bound(
+            lower.begin()+begin,
+            lower.begin()+end,
+            value,
+            [](const Value &value,const Segment &segment){return value<segment.key_;});
+        segmentIndex=(next==lower.begin()?0:size_t(next-lower.begin())-1);
+    }
+    predict(levels_.front(),segmentIndex,values_.size(),value,begin,end);
+    return size_t(std::lower_bound(values_.begin()+begin,values_.begin()+end,value)-values_.begin());
+}
+template<typename Value>
+void LearnedIndexSet<Value>::predict(
+    const Segments &segments,
+    size_t segmentIndex,
+    size_t count,
+    const Value &value,
+    size_t &begin,
+    size_t &end) const
+{//the answer is within the error of the prediction, or just past the segment when the value lies between segments
+    const auto &segment=segments[segmentIndex];
+    const auto segmentEnd=(segmentIndex+1<segments.size()?segments[segmentIndex+1].position_:count);
+    auto position=segment.position_;
+    if(segment.key_<value)
+    {
+        const auto offset=segment.slope_*getDistance(segment.key_,value);
+        position=(offset<double(segmentEnd-position)?position+size_t(offset):segmentEnd);
+    }
+    const auto margin=maxError_+2;//for the rounding of the prediction and the lookup of the next value
+    begin=(position-segment.position_>margin?position-margin:segment.position_);
+    end=std::min(segmentEnd,position+margin);
+}
+template<typename Value>
+typename LearnedIndexSet<Value>::Segments LearnedIndexSet<Value>::fit(const std::vector<Value> &keys,size_t maxError)
+{//greedy shrinking cone: a segment grows while some slope through its first key keeps all keys within the error
+    Segments segments;
+    size_t first=0;
+    while(first<keys.size())
+    {
+        double lowSlope=0,highSlope=std::numeric_limits<double>::infinity();
+        auto last=first+1;
+        for(;last<keys.size();++last)
+        {
+            const auto distance=getDistance(keys[first],keys[last]);
+            const auto positionDifference=double(last-first);
+            const auto newLowSlope=std::max(lowSlope,(positionDifference-double(maxError))/distance);
+            const auto newHighSlope=std::min(highSlope,(positionDifference+double(maxError))/distance);
+            if(newLowSlope>newHighSlope)
+                break;
+            lowSlope=newLowSlope;
+            highSlope=newHighSlope;
+        }
+        const auto slope=(last==first+1?0:(lowSlope+highSlope)/2);
+        segments.push_back({keys[first],slope,first});
+        first=last;
+    }
+    return segments;
+}
+template<typename Value>
+double LearnedIndexSet<Value>::getDistance(const Value &from,const Value &to)
+{//unsigned difference doesn't overflow for signed values far apart
+    using Unsigned=typename std::make_unsigned<Value>::type;
+    return double(Unsigned(Unsigned(to)-Unsigned(from)));
+}
+template<typename Value>
+std::vector<Value> LearnedIndexSet<Value>::collect(const BTree<Value> &tree)
+{
+    std::vector<Value> values;
+    tree.enumerate([&](const Value &value){values.push_back(value);});
+    return values;
+}
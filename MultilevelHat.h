@@ -1,73 +1,269 @@
 #pragma once
 #include <algorithm>
 #include <functional>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
 #include <variant>
 #include <vector>
-template<typename Value>
+#include "Statistics.h"
+template<typename Value,typename Allocator=std::allocator<Value>,typename Statistics=NoStatistics>
 class MultilevelHat
 {
 public:
     class Iterator;
-    MultilevelHat(size_t minChunkSize,size_t maxChunkSize);
+    //a node is rebalanced only after it loses underflowSlack values below minChunkSize,
+    //so churn at the limit doesn't merge and split it back and forth;
+    //deferredRebalancing merges only empty nodes and leaves the rest to compact()
+    MultilevelHat(size_t minChunkSize,size_t maxChunkSize,size_t underflowSlack=0);
+    static const size_t deferredRebalancing=size_t(-1);
     void insert(const Value&);
     void erase(const Value&);
     bool contains(const Value&) const;
     void enumerate(const std::function<void(const Value&)>&) const;
+    //the outermost leaves are kept at the root, as in BTree, so these are O(1) apart from taking
+    //the next leaf once one is popped empty; all of them throw on an empty container
+    const Value &min() const;
+    const Value &max() const;
+    Value popMin();
+    Value popMax();
+    void setChunkSizes(size_t minChunkSize,size_t maxChunkSize);//existing nodes follow on their next split or merge
+    void compact();//rebuilds the container with all nodes between minChunkSize and maxChunkSize
+    LeafFill statistics() const;//counters are process-wide, see Statistics::getCounters()
 private:
-    using Leaf=std::vector<Value>;
+    template<typename Item>
+    using Vector=std::vector<Item,typename std::allocator_traits<Allocator>::template rebind_alloc<Item>>;
+    using Leaf=Vector<Value>;
     struct Node
     {
-        std::variant<Leaf,std::vector<Node>> content_;
+        std::variant<Leaf,Vector<Node>> content_;
     };
     size_t minChunkSize_,maxChunkSize_;
+    size_t underflowSlack_;
     Node root_;
+    //out of the tree, first_ in descending order; first_ is empty only in an empty container,
+    //last_ only when the tree is empty as well
+    Leaf first_,last_;
     void insert(const Value&,Node&);
     void increaseDepthIfNeeded();
     void erase(const Value&,Node&);
     void decreaseDepthIfNeeded();
+    void refillFirst();//after first_ got empty
+    void refillLast();//after last_ got empty
+    void spillFirst();//after first_ got overfull
+    void spillLast();//after last_ got overfull
+    void detachFirstLeaf(Node&,Leaf&) const;//appends values of the first leaf in descending order
+    void detachLastLeaf(Node&,Leaf&) const;
+    //sorted values beyond all values of the node go to its outermost leaf
+    void insertFirst(Leaf&&,Node&) const;
+    void insertLast(Leaf&&,Node&) const;
+    static void insertIntoLeaf(Leaf&,size_t index,const Value&);//unless the value is at the index already
+    static void eraseFromLeaf(Leaf&,size_t index,const Value&);//if the value is at the index
+    static size_t findIndexInFirst(const Leaf &first,const Value&);//first_ is descending, returns first element<=value
     static size_t findIndexForValue(const Leaf&,const Value &value);//returns first element>=value
-    static size_t findChildIndexForValue(const std::vector<Node>&,const Value &value);//last child with smallest<=value
+    static size_t findChildIndexForValue(const Vector<Node>&,const Value &value);//last child with smallest<=value
     static size_t getNodeSize(const Node&);
-    static void splitChild(std::vector<Node>&,size_t childIndex);
-    static void mergeChild(std::vector<Node>&,size_t childIndex);
+    static void splitChild(Vector<Node>&,size_t childIndex);
+    static void mergeChild(Vector<Node>&,size_t childIndex);
+    bool borrowFromSibling(Vector<Node>&,size_t childIndex) const;//returns false if siblings have nothing to spare
+    template<typename Item>
+    static void moveBetweenSiblings(Vector<Item> &left,Vector<Item> &right,size_t count,bool toLeft);
+    size_t getUnderflowChunkSize(bool isLeaf) const;
+    std::vector<size_t> getEvenChunkSizes(size_t count) const;
     static bool contains(const Node&,const Value&);
     static void enumerate(const Node&,const std::function<void(const Value&)>&);
+    void addLeaves(const Node&,LeafFill&) const;
     static const Value &getSmallestValueInNode(const Node&);
+    static const Value &getLargestValueInNode(const Node&);
+    void rebalanceChild(Vector<Node>&,size_t childIndex) const;
 };
 ///////////////////////////////////////////////////////////////////////////////
-template<typename Value>
-MultilevelHat<Value>::MultilevelHat(size_t minChunkSize,size_t maxChunkSize)
+template<typename Value,typename Allocator,typename Statistics>
+MultilevelHat<Value,Allocator,Statistics>::MultilevelHat(size_t minChunkSize,size_t maxChunkSize,size_t underflowSlack)
     :minChunkSize_(minChunkSize)
     ,maxChunkSize_(maxChunkSize)
+    ,underflowSlack_(underflowSlack)
 {}
-template<typename Value>
-void MultilevelHat<Value>::insert(const Value &value)
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHat<Value,Allocator,Statistics>::insert(const Value &value)
 {
-    insert(value,root_);
-    increaseDepthIfNeeded();
+    Statistics::add(Counter::insertion);
+    if(first_.empty() || !(first_.front()<value))
+    {
+        insertIntoLeaf(first_,findIndexInFirst(first_,value),value);
+        if(first_.size()>maxChunkSize_)
+            spillFirst();
+    }
+    else if(last_.empty() || !(value<last_.front()))
+    {//last_ is empty only when the tree is
+        insertIntoLeaf(last_,findIndexForValue(last_,value),value);
+        if(last_.size()>maxChunkSize_)
+            spillLast();
+    }
+    else
+    {
+        insert(value,root_);
+        increaseDepthIfNeeded();
+    }
 }
-template<typename Value>
-void MultilevelHat<Value>::erase(const Value &value)
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHat<Value,Allocator,Statistics>::erase(const Value &value)
 {
-    erase(value,root_);
-    decreaseDepthIfNeeded();
+    if(!first_.empty() && !(first_.front()<value))
+    {
+        eraseFromLeaf(first_,findIndexInFirst(first_,value),value);
+        if(first_.empty())
+            refillFirst();
+    }
+    else if(!last_.empty() && !(value<last_.front()))
+    {
+        eraseFromLeaf(last_,findIndexForValue(last_,value),value);
+        if(last_.empty())
+            refillLast();
+    }
+    else
+    {
+        erase(value,root_);
+        decreaseDepthIfNeeded();
+    }
 }
-template<typename Value>
-bool MultilevelHat<Value>::contains(const Value &value) const
+template<typename Value,typename Allocator,typename Statistics>
+bool MultilevelHat<Value,Allocator,Statistics>::contains(const Value &value) const
 {
+    Statistics::add(Counter::lookup);
+    if(!first_.empty() && !(first_.front()<value))
+    {
+        Statistics::add(Counter::visitedNode);
+        const auto index=findIndexInFirst(first_,value);
+        return index<first_.size() && first_[index]==value;
+    }
+    if(!last_.empty() && !(value<last_.front()))
+    {
+        Statistics::add(Counter::visitedNode);
+        const auto index=findIndexForValue(last_,value);
+        return index<last_.size() && last_[index]==value;
+    }
     return contains(root_,value);
 }
-template<typename Value>
-void MultilevelHat<Value>::enumerate(const std::function<void(const Value&)> &processor) const
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHat<Value,Allocator,Statistics>::enumerate(const std::function<void(const Value&)> &processor) const
 {
+    for(auto value=first_.rbegin();value!=first_.rend();++value)
+        processor(*value);
     enumerate(root_,processor);
+    for(const auto &value:last_)
+        processor(value);
+}
+template<typename Value,typename Allocator,typename Statistics>
+const Value &MultilevelHat<Value,Allocator,Statistics>::min() const
+{
+    if(first_.empty())
+        throw std::logic_error("the container is empty");
+    return first_.back();
+}
+template<typename Value,typename Allocator,typename Statistics>
+const Value &MultilevelHat<Value,Allocator,Statistics>::max() const
+{
+    if(first_.empty())
+        throw std::logic_error("the container is empty");
+    return (last_.empty()?first_.front():last_.back());
 }
-template<typename Value>
-void MultilevelHat<Value>::insert(const Value &value,Node &node)
+template<typename Value,typename Allocator,typename Statistics>
+Value MultilevelHat<Value,Allocator,Statistics>::popMin()
+{
+    if(first_.empty())
+        throw std::logic_error("the container is empty");
+    auto value=std::move(first_.back());
+    first_.pop_back();
+    if(first_.empty())
+        refillFirst();
+    return value;
+}
+template<typename Value,typename Allocator,typename Statistics>
+Value MultilevelHat<Value,Allocator,Statistics>::popMax()
+{
+    if(first_.empty())
+        throw std::logic_error("the container is empty");
+    if(last_.empty())
+    {//all values are in first_, which is no longer than a leaf
+        auto value=std::move(first_.front());
+        first_.erase(first_.begin());
+        return value;
+    }
+    auto value=std::move(last_.back());
+    last_.pop_back();
+    if(last_.empty())
+        refillLast();
+    return value;
+}
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHat<Value,Allocator,Statistics>::setChunkSizes(size_t minChunkSize,size_t maxChunkSize)
+{
+    minChunkSize_=minChunkSize;
+    maxChunkSize_=maxChunkSize;
+}
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHat<Value,Allocator,Statistics>::compact()
+{//rebuilt bottom-up from sorted values, the outermost leaves stay as they are
+    Vector<Node> nodes;
+    {
+        Leaf values;
+        enumerate(root_,[&](const Value &value){values.push_back(value);});
+        size_t position=0;
+        for(const auto size:getEvenChunkSizes(values.size()))
+        {
+            Node node;
+            node.content_=Leaf(
+                std::make_move_iterator(values.begin()+position),
+                std::make_move_iterator(values.begin()+position+size));
+            nodes.push_back(std::move(node));
+            position+=size;
+        }
+    }
+    while(nodes.size()>maxChunkSize_)
+    {
+        Vector<Node> parents;
+        size_t position=0;
+        for(const auto size:getEvenChunkSizes(nodes.size()))
+        {
+            Node parent;
+            parent.content_=Vector<Node>(
+                std::make_move_iterator(nodes.begin()+position),
+                std::make_move_iterator(nodes.begin()+position+size));
+            parents.push_back(std::move(parent));
+            position+=size;
+        }
+        nodes=std::move(parents);
+    }
+    if(nodes.size()==1)
+        root_=std::move(nodes.front());
+    else
+        root_.content_=std::move(nodes);
+}
+template<typename Value,typename Allocator,typename Statistics>
+LeafFill MultilevelHat<Value,Allocator,Statistics>::statistics() const
+{
+    LeafFill fill;
+    if(!first_.empty())
+        fill.addLeaf(first_.size(),maxChunkSize_);
+    addLeaves(root_,fill);
+    if(!last_.empty())
+        fill.addLeaf(last_.size(),maxChunkSize_);
+    return fill;
+}
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHat<Value,Allocator,Statistics>::insert(const Value &value,Node &node)
 {
     if(auto *leaf=std::get_if<Leaf>(&node.content_))
-        leaf->insert(leaf->begin()+findIndexForValue(*leaf,value),value);
-    else if(auto *children=std::get_if<std::vector<Node>>(&node.content_))
+    {
+        const auto index=findIndexForValue(*leaf,value);
+        if(index==leaf->size() || (*leaf)[index]!=value)
+        {
+            Statistics::add(Counter::movedValue,leaf->size()-index);
+            leaf->insert(leaf->begin()+index,value);
+        }
+    }
+    else if(auto *children=std::get_if<Vector<Node>>(&node.content_))
     {
         const auto index=findChildIndexForValue(*children,value);
         insert(value,(*children)[index]);
@@ -75,18 +271,19 @@ void MultilevelHat<Value>::insert(const Value &value,Node &node)
             splitChild(*children,index);
     }
 }
-template<typename Value>
-void MultilevelHat<Value>::increaseDepthIfNeeded()
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHat<Value,Allocator,Statistics>::increaseDepthIfNeeded()
 {
     if(getNodeSize(root_)<=maxChunkSize_)
         return;
-    std::vector<Node> newRootChildren;
+    Statistics::add(Counter::depthIncrease);
+    Vector<Node> newRootChildren;
     newRootChildren.push_back(std::move(root_));
     splitChild(newRootChildren,0);
     root_.content_=std::move(newRootChildren);
 }
-template<typename Value>
-void MultilevelHat<Value>::erase(const Value &value,Node &node)
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHat<Value,Allocator,Statistics>::erase(const Value &value,Node &node)
 {
     if(auto *leaf=std::get_if<Leaf>(&node.content_))
     {
@@ -94,35 +291,157 @@ void MultilevelHat<Value>::erase(const Value &value,Node &node)
         if(index!=leaf->size() && (*leaf)[index]==value)
             leaf->erase(leaf->begin()+index);
     }
-    else if(auto *children=std::get_if<std::vector<Node>>(&node.content_))
+    else if(auto *children=std::get_if<Vector<Node>>(&node.content_))
     {
         const auto index=findChildIndexForValue(*children,value);
         erase(value,(*children)[index]);
-        if(getNodeSize((*children)[index])<minChunkSize_)
-        {
-            mergeChild(*children,index);
-            if(index<children->size() && getNodeSize((*children)[index])>maxChunkSize_)
-                splitChild(*children,index);
-            else//we might merge to the previous node
-                if(index>0 && getNodeSize((*children)[index-1])>maxChunkSize_)
-                    splitChild(*children,index-1);
-        }
+        rebalanceChild(*children,index);
     }
 }
-template<typename Value>
-void MultilevelHat<Value>::decreaseDepthIfNeeded()
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHat<Value,Allocator,Statistics>::decreaseDepthIfNeeded()
 {
-    if(auto *children=std::get_if<std::vector<Node>>(&root_.content_))
+    if(auto *children=std::get_if<Vector<Node>>(&root_.content_))
     {
         if(children->size()==1)
         {
+            Statistics::add(Counter::depthDecrease);
             auto newRoot=Node(std::move(children->front()));
             root_=std::move(newRoot);
         }
     }
 }
-template<typename Value>
-size_t MultilevelHat<Value>::findIndexForValue(const Leaf &leaf,const Value &value)
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHat<Value,Allocator,Statistics>::refillFirst()
+{//the next leaf comes from the tree, or last_ is all that is left
+    if(getNodeSize(root_)>0)
+    {
+        detachFirstLeaf(root_,first_);
+        decreaseDepthIfNeeded();
+    }
+    else
+    {
+        first_.assign(std::make_move_iterator(last_.rbegin()),std::make_move_iterator(last_.rend()));
+        last_.clear();
+    }
+}
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHat<Value,Allocator,Statistics>::refillLast()
+{
+    if(getNodeSize(root_)==0)
+        return;
+    detachLastLeaf(root_,last_);
+    decreaseDepthIfNeeded();
+}
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHat<Value,Allocator,Statistics>::spillFirst()
+{//the larger half becomes the first leaf of the tree, or last_ if there is no tree
+    const auto count=first_.size()/2;
+    Leaf values(std::make_move_iterator(first_.rend()-count),std::make_move_iterator(first_.rend()));
+    first_.erase(first_.begin(),first_.begin()+count);
+    if(last_.empty())
+        last_=std::move(values);
+    else
+    {
+        insertFirst(std::move(values),root_);
+        increaseDepthIfNeeded();
+    }
+}
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHat<Value,Allocator,Statistics>::spillLast()
+{
+    const auto count=last_.size()/2;
+    Leaf values(std::make_move_iterator(last_.begin()),std::make_move_iterator(last_.begin()+count));
+    last_.erase(last_.begin(),last_.begin()+count);
+    insertLast(std::move(values),root_);
+    increaseDepthIfNeeded();
+}
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHat<Value,Allocator,Statistics>::detachFirstLeaf(Node &node,Leaf &values) const
+{//no comparisons on the way down; a node left with a single child is rebalanced by its parent
+    if(auto *leaf=std::get_if<Leaf>(&node.content_))
+    {//the root is the only leaf
+        std::move(leaf->rbegin(),leaf->rend(),std::back_inserter(values));
+        leaf->clear();
+        return;
+    }
+    auto &children=std::get<Vector<Node>>(node.content_);
+    if(auto *leaf=std::get_if<Leaf>(&children.front().content_))
+    {
+        std::move(leaf->rbegin(),leaf->rend(),std::back_inserter(values));
+        children.erase(children.begin());
+        return;
+    }
+    detachFirstLeaf(children.front(),values);
+    rebalanceChild(children,0);
+}
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHat<Value,Allocator,Statistics>::detachLastLeaf(Node &node,Leaf &values) const
+{
+    if(auto *leaf=std::get_if<Leaf>(&node.content_))
+    {
+        std::move(leaf->begin(),leaf->end(),std::back_inserter(values));
+        leaf->clear();
+        return;
+    }
+    auto &children=std::get<Vector<Node>>(node.content_);
+    if(auto *leaf=std::get_if<Leaf>(&children.back().content_))
+    {
+        std::move(leaf->begin(),leaf->end(),std::back_inserter(values));
+        children.pop_back();
+        return;
+    }
+    detachLastLeaf(children.back(),values);
+    rebalanceChild(children,children.size()-1);
+}
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHat<Value,Allocator,Statistics>::insertFirst(Leaf &&values,Node &node) const
+{//an overfull leaf is at most twice as large as allowed, so a single split on each level is enough
+    if(auto *leaf=std::get_if<Leaf>(&node.content_))
+    {
+        Statistics::add(Counter::movedValue,leaf->size());
+        leaf->insert(leaf->begin(),std::make_move_iterator(values.begin()),std::make_move_iterator(values.end()));
+        return;
+    }
+    auto &children=std::get<Vector<Node>>(node.content_);
+    insertFirst(std::move(values),children.front());
+    if(getNodeSize(children.front())>maxChunkSize_)
+        splitChild(children,0);
+}
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHat<Value,Allocator,Statistics>::insertLast(Leaf &&values,Node &node) const
+{
+    if(auto *leaf=std::get_if<Leaf>(&node.content_))
+    {
+        std::move(values.begin(),values.end(),std::back_inserter(*leaf));
+        return;
+    }
+    auto &children=std::get<Vector<Node>>(node.content_);
+    insertLast(std::move(values),children.back());
+    if(getNodeSize(children.back())>maxChunkSize_)
+        splitChild(children,children.size()-1);
+}
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHat<Value,Allocator,Statistics>::insertIntoLeaf(Leaf &leaf,size_t index,const Value &value)
+{
+    if(index<leaf.size() && leaf[index]==value)
+        return;//the value is already in the container
+    Statistics::add(Counter::movedValue,leaf.size()-index);
+    leaf.insert(leaf.begin()+index,value);
+}
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHat<Value,Allocator,Statistics>::eraseFromLeaf(Leaf &leaf,size_t index,const Value &value)
+{
+    if(index<leaf.size() && leaf[index]==value)
+        leaf.erase(leaf.begin()+index);
+}
+template<typename Value,typename Allocator,typename Statistics>
+size_t MultilevelHat<Value,Allocator,Statistics>::findIndexInFirst(const Leaf &first,const Value &value)
+{//smallest values sit at the end, so popping and inserting them moves little
+    return size_t(std::lower_bound(first.begin(),first.end(),value,[](const Value &left,const Value &right){return right<left;})-first.begin());
+}
+template<typename Value,typename Allocator,typename Statistics>
+size_t MultilevelHat<Value,Allocator,Statistics>::findIndexForValue(const Leaf &leaf,const Value &value)
 {
     size_t current=leaf.size();
     size_t step=leaf.size();
@@ -135,8 +454,8 @@ size_t MultilevelHat<Value>::findIndexForValue(const Leaf &leaf,const Value &val
     }
     return current;
 }
-template<typename Value>
-size_t MultilevelHat<Value>::findChildIndexForValue(const std::vector<Node> &nodes,const Value &value)
+template<typename Value,typename Allocator,typename Statistics>
+size_t MultilevelHat<Value,Allocator,Statistics>::findChildIndexForValue(const Vector<Node> &nodes,const Value &value)
 {
     size_t current=0;
     size_t step=nodes.size();
@@ -149,19 +468,21 @@ size_t MultilevelHat<Value>::findChildIndexForValue(const std::vector<Node> &nod
     }
     return current;
 }
-template<typename Value>
-size_t MultilevelHat<Value>::getNodeSize(const Node &node)
+template<typename Value,typename Allocator,typename Statistics>
+size_t MultilevelHat<Value,Allocator,Statistics>::getNodeSize(const Node &node)
 {
     if(auto *leaf=std::get_if<Leaf>(&node.content_))
         return leaf->size();
-    else if(auto *children=std::get_if<std::vector<Node>>(&node.content_))
+    else if(auto *children=std::get_if<Vector<Node>>(&node.content_))
         return children->size();
     else
         throw std::logic_error("hmmmm... unknown node type");
 }
-template<typename Value>
-void MultilevelHat<Value>::splitChild(std::vector<Node> &nodes,size_t childIndex)
-{
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHat<Value,Allocator,Statistics>::splitChild(Vector<Node> &nodes,size_t childIndex)
+{//both halves are moved to new nodes
+    Statistics::add(Counter::split);
+    Statistics::add(Counter::movedValue,getNodeSize(nodes[childIndex]));
     Node newChild1,newChild2;
     if(auto *leaf=std::get_if<Leaf>(&nodes[childIndex].content_))
     {
@@ -172,10 +493,10 @@ void MultilevelHat<Value>::splitChild(std::vector<Node> &nodes,size_t childIndex
         newChild1.content_=std::move(firstHalf);
         newChild2.content_=std::move(secondHalf);
     }
-    else if(auto *children=std::get_if<std::vector<Node>>(&nodes[childIndex].content_))
+    else if(auto *children=std::get_if<Vector<Node>>(&nodes[childIndex].content_))
     {
         const auto middle=children->begin()+children->size()/2;
-        std::vector<Node> firstHalf,secondHalf;
+        Vector<Node> firstHalf,secondHalf;
         std::move(children->begin(),middle,std::back_inserter(firstHalf));
         std::move(middle,children->end(),std::back_inserter(secondHalf));
         newChild1.content_=std::move(firstHalf);
@@ -184,8 +505,8 @@ void MultilevelHat<Value>::splitChild(std::vector<Node> &nodes,size_t childIndex
     nodes[childIndex]=std::move(newChild1);
     nodes.insert(nodes.begin()+childIndex+1,std::move(newChild2));
 }
-template<typename Value>
-void MultilevelHat<Value>::mergeChild(std::vector<Node> &nodes,size_t childIndex)
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHat<Value,Allocator,Statistics>::mergeChild(Vector<Node> &nodes,size_t childIndex)
 {
     if(childIndex>0)
     {//consider merging to the left node
@@ -194,6 +515,7 @@ void MultilevelHat<Value>::mergeChild(std::vector<Node> &nodes,size_t childIndex
         else if(getNodeSize(nodes[childIndex-1])<getNodeSize(nodes[childIndex+1]))
             --childIndex;
     }
+    Statistics::add(Counter::merge);
     if(auto *sourceLeaf=std::get_if<Leaf>(&nodes[childIndex+1].content_))
     {
         auto *targetLeaf=std::get_if<Leaf>(&nodes[childIndex].content_);
@@ -201,24 +523,25 @@ void MultilevelHat<Value>::mergeChild(std::vector<Node> &nodes,size_t childIndex
             throw std::logic_error("AAAAAAAA!!!! PANIC!!!!!");
         std::move(sourceLeaf->begin(),sourceLeaf->end(),std::back_inserter(*targetLeaf));
     }
-    if(auto *sourceChildren=std::get_if<std::vector<Node>>(&nodes[childIndex+1].content_))
+    if(auto *sourceChildren=std::get_if<Vector<Node>>(&nodes[childIndex+1].content_))
     {
-        auto *targetChildren=std::get_if<std::vector<Node>>(&nodes[childIndex].content_);
+        auto *targetChildren=std::get_if<Vector<Node>>(&nodes[childIndex].content_);
         if(!targetChildren)
             throw std::logic_error("AAAAAAAA!!!! PANIC!!!!!");
         std::move(sourceChildren->begin(),sourceChildren->end(),std::back_inserter(*targetChildren));
     }
     nodes.erase(nodes.begin()+childIndex+1);
 }
-template<typename Value>
-bool MultilevelHat<Value>::contains(const Node &node,const Value &value)
+template<typename Value,typename Allocator,typename Statistics>
+bool MultilevelHat<Value,Allocator,Statistics>::contains(const Node &node,const Value &value)
 {
+    Statistics::add(Counter::visitedNode);
     if(auto *leaf=std::get_if<Leaf>(&node.content_))
     {
         const auto index=findIndexForValue(*leaf,value);
         return (index<leaf->size() && (*leaf)[index]==value);
     }
-    else if(auto *children=std::get_if<std::vector<Node>>(&node.content_))
+    else if(auto *children=std::get_if<Vector<Node>>(&node.content_))
     {
         const auto index=findChildIndexForValue(*children,value);
         return contains((*children)[index],value);
@@ -226,27 +549,126 @@ bool MultilevelHat<Value>::contains(const Node &node,const Value &value)
     else
         throw std::logic_error("hmmm... unknown node type");
 }
-template<typename Value>
-void MultilevelHat<Value>::enumerate(const Node &node,const std::function<void(const Value&)> &processor)
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHat<Value,Allocator,Statistics>::enumerate(const Node &node,const std::function<void(const Value&)> &processor)
 {
     if(auto *leaf=std::get_if<Leaf>(&node.content_))
     {
         for(const auto &value:*leaf)
             processor(value);
     }
-    else if(auto *children=std::get_if<std::vector<Node>>(&node.content_))
+    else if(auto *children=std::get_if<Vector<Node>>(&node.content_))
     {
         for(const auto &node:*children)
             enumerate(node,processor);
     }
 }
-template<typename Value>
-const Value &MultilevelHat<Value>::getSmallestValueInNode(const Node &node)
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHat<Value,Allocator,Statistics>::addLeaves(const Node &node,LeafFill &fill) const
+{
+    if(auto *leaf=std::get_if<Leaf>(&node.content_))
+        fill.addLeaf(leaf->size(),maxChunkSize_);
+    else if(auto *children=std::get_if<Vector<Node>>(&node.content_))
+        for(const auto &child:*children)
+            addLeaves(child,fill);
+}
+template<typename Value,typename Allocator,typename Statistics>
+const Value &MultilevelHat<Value,Allocator,Statistics>::getSmallestValueInNode(const Node &node)
 {
     if(auto *leaf=std::get_if<Leaf>(&node.content_))
         return leaf->front();
-    else if(auto *children=std::get_if<std::vector<Node>>(&node.content_))
+    else if(auto *children=std::get_if<Vector<Node>>(&node.content_))
         return getSmallestValueInNode(children->front());
     else
         throw std::logic_error("hmmmm... unknown node content...");
 }
+template<typename Value,typename Allocator,typename Statistics>
+const Value &MultilevelHat<Value,Allocator,Statistics>::getLargestValueInNode(const Node &node)
+{
+    if(auto *leaf=std::get_if<Leaf>(&node.content_))
+        return leaf->back();
+    else if(auto *children=std::get_if<Vector<Node>>(&node.content_))
+        return getLargestValueInNode(children->back());
+    else
+        throw std::logic_error("hmmmm... unknown node content...");
+}
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHat<Value,Allocator,Statistics>::rebalanceChild(Vector<Node> &children,size_t index) const
+{
+    const bool isLeaf=std::holds_alternative<Leaf>(children[index].content_);
+    if(getNodeSize(children[index])<getUnderflowChunkSize(isLeaf) && children.size()>1)
+    {
+        if(borrowFromSibling(children,index))
+            return;//moves only a few values and leaves both nodes away from the limits
+        mergeChild(children,index);
+        if(index<children.size() && getNodeSize(children[index])>maxChunkSize_)
+            splitChild(children,index);
+        else//we might merge to the previous node
+            if(index>0 && getNodeSize(children[index-1])>maxChunkSize_)
+                splitChild(children,index-1);
+    }
+}
+template<typename Value,typename Allocator,typename Statistics>
+bool MultilevelHat<Value,Allocator,Statistics>::borrowFromSibling(Vector<Node> &nodes,size_t childIndex) const
+{//the larger neighbour gives values (or children) until both nodes have the same size
+    const bool hasLeft=(childIndex>0);
+    const bool hasRight=(childIndex+1<nodes.size());
+    const bool fromLeft=hasLeft
+        && (!hasRight || getNodeSize(nodes[childIndex-1])>getNodeSize(nodes[childIndex+1]));
+    auto &child=nodes[childIndex];
+    auto &sibling=nodes[fromLeft?childIndex-1:childIndex+1];
+    const auto siblingSize=getNodeSize(sibling);
+    if(siblingSize<=minChunkSize_)
+        return false;
+    const auto count=(siblingSize-getNodeSize(child))/2;
+    auto &left=(fromLeft?sibling:child);
+    auto &right=(fromLeft?child:sibling);
+    if(auto *leftLeaf=std::get_if<Leaf>(&left.content_))
+        moveBetweenSiblings(*leftLeaf,std::get<Leaf>(right.content_),count,!fromLeft);
+    else
+        moveBetweenSiblings(
+            std::get<Vector<Node>>(left.content_),
+            std::get<Vector<Node>>(right.content_),
+            count,
+            !fromLeft);
+    return true;
+}
+template<typename Value,typename Allocator,typename Statistics>
+template<typename Item>
+void MultilevelHat<Value,Allocator,Statistics>::moveBetweenSiblings(Vector<Item> &left,Vector<Item> &right,size_t count,bool toLeft)
+{
+    if(toLeft)
+    {
+        std::move(right.begin(),right.begin()+count,std::back_inserter(left));
+        right.erase(right.begin(),right.begin()+count);
+    }
+    else
+    {
+        Vector<Item> items;
+        items.reserve(count+right.size());
+        std::move(left.end()-count,left.end(),std::back_inserter(items));
+        std::move(right.begin(),right.end(),std::back_inserter(items));
+        right=std::move(items);
+        left.erase(left.end()-count,left.end());
+    }
+}
+template<typename Value,typename Allocator,typename Statistics>
+size_t MultilevelHat<Value,Allocator,Statistics>::getUnderflowChunkSize(bool isLeaf) const
+{//leaves are never left empty and inner nodes keep at least two children, so every node has a smallest value
+    const auto size=(underflowSlack_<minChunkSize_?minChunkSize_-underflowSlack_:1);
+    return (isLeaf?size:std::max<size_t>(size,2));
+}
+template<typename Value,typename Allocator,typename Statistics>
+std::vector<size_t> MultilevelHat<Value,Allocator,Statistics>::getEvenChunkSizes(size_t count) const
+{//sizes of consecutive chunks close to the middle of the allowed range
+    const auto targetChunkSize=std::max<size_t>((minChunkSize_+maxChunkSize_)/2,1);
+    auto chunkCount=std::max<size_t>((count+targetChunkSize/2)/targetChunkSize,1);
+    while(chunkCount>1 && count/chunkCount<minChunkSize_)
+        --chunkCount;
+    while((count+chunkCount-1)/chunkCount>maxChunkSize_)
+        ++chunkCount;
+    std::vector<size_t> sizes;
+    for(size_t index=0;index<chunkCount;++index)
+        sizes.push_back(count/chunkCount+(index<count%chunkCount?1:0));
+    return sizes;
+}
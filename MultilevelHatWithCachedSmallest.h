@@ -1,137 +1,702 @@
 #pragma once
 #include <algorithm>
 #include <functional>
-#include <variant>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
 #include <vector>
-template<typename Value>
+#include "Statistics.h"
+template<typename Value,typename Allocator=std::allocator<Value>,typename Statistics=NoStatistics>
 class MultilevelHatWithCachedSmallest
 {
 public:
     class Iterator;
-    MultilevelHatWithCachedSmallest(size_t minChunkSize,size_t maxChunkSize);
+    //underflowSlack and deferredRebalancing work as in MultilevelHat
+    MultilevelHatWithCachedSmallest(size_t minChunkSize,size_t maxChunkSize,size_t underflowSlack=0);
+    static const size_t deferredRebalancing=size_t(-1);
     void insert(const Value&);
     void erase(const Value&);
+    //as in BTree, the outermost leaves are trimmed in place and [from,to) is cut out of the tree with split()
+    //and join(), subtrees inside the range are freed whole
+    size_t eraseRange(const Value &from,const Value &to);//returns the number of erased values
+    size_t eraseIf(const std::function<bool(const Value&)>&);//the container is rebuilt from the values left, if any are erased
     bool contains(const Value&) const;
     void enumerate(const std::function<void(const Value&)>&) const;
+    //[from,to), children left of from are skipped and the walk stops at to
+    void enumerateRange(const Value &from,const Value &to,const std::function<void(const Value&)>&) const;
+    //the outermost leaves are kept at the root, as in BTree, so these are O(1) apart from taking
+    //the next leaf once one is popped empty; all of them throw on an empty container
+    const Value &min() const;
+    const Value &max() const;
+    Value popMin();
+    Value popMax();
+    void setChunkSizes(size_t minChunkSize,size_t maxChunkSize);//existing nodes follow on their next split or merge
+    void compact();//rebuilds the container with all nodes between minChunkSize and maxChunkSize
+    //values<value go to the first container, the rest to the second one
+    static std::pair<MultilevelHatWithCachedSmallest,MultilevelHatWithCachedSmallest> split(
+        MultilevelHatWithCachedSmallest&&,
+        const Value&);
+    //all values of the left container must be less than values of the right one
+    static MultilevelHatWithCachedSmallest join(MultilevelHatWithCachedSmallest &&left,MultilevelHatWithCachedSmallest &&right);
+    LeafFill statistics() const;//counters are process-wide, see Statistics::getCounters()
 private:
-    using Leaf=std::vector<Value>;
-    struct Node
-    {
-        std::variant<Leaf,std::vector<Node>> content_;
-        Value smallest_;
+    template<typename Item>
+    using Vector=std::vector<Item,typename std::allocator_traits<Allocator>::template rebind_alloc<Item>>;
+    using Leaf=Vector<Value>;
+    struct Inner
+    {//smallest values of children are kept apart from them, so choosing a child reads only this array
+        Vector<Value> keys_;
+        Vector<Leaf> leaves_;//children of the lowest inner nodes
+        Vector<Inner> children_;//children of all other inner nodes
     };
     size_t minChunkSize_,maxChunkSize_;
-    Node root_;
-    void insert(const Value&,Node&);
+    size_t underflowSlack_;
+    Inner root_;//the root is always an inner node, it has no keys when the tree is empty
+    //out of the tree, first_ in descending order; first_ is empty only in an empty container,
+    //last_ only when the tree is empty as well
+    Leaf first_,last_;
+    void insertIntoTree(const Value&);
+    void eraseFromTree(const Value&);
+    void insert(const Value&,Inner&);
     void increaseDepthIfNeeded();
-    void erase(const Value&,Node&);
+    void erase(const Value&,Inner&);
     void decreaseDepthIfNeeded();
+    void refillFirst();//after first_ got empty
+    void refillLast();//after last_ got empty
+    void spillFirst();//after first_ got overfull
+    void spillLast();//after last_ got overfull
+    void attachEnds();//the tree holds all values afterwards, for operations on the whole tree
+    void detachEnds();
+    size_t getValueCount() const;
+    size_t eraseRangeFromEnds(const Value &from,const Value &to);//first_ and last_ are not refilled
+    void detachFirstLeaf(Inner&,Leaf&) const;//appends values of the first leaf in descending order
+    void detachLastLeaf(Inner&,Leaf&) const;
+    //sorted values beyond all values of the tree go to its outermost leaf
+    void insertFirst(Leaf&&);
+    void insertLast(Leaf&&);
+    void insertFirst(Leaf&&,Inner&) const;
+    void insertLast(Leaf&&,Inner&) const;
+    static void insertIntoLeaf(Leaf&,size_t index,const Value&);//unless the value is at the index already
+    static void eraseFromLeaf(Leaf&,size_t index,const Value&);//if the value is at the index
+    static size_t findIndexInFirst(const Leaf &first,const Value&);//first_ is descending, returns first element<=value
+    void rebuild(Leaf &&values);//bottom-up from sorted values
     static size_t findIndexForValue(const Leaf&,const Value &value);//returns first element>=value
-    static size_t findChildIndexForValue(const std::vector<Node>&,const Value &value);//last child with smallest<=value
-    static size_t getNodeSize(const Node&);
-    static void splitChild(std::vector<Node>&,size_t childIndex);
-    static void mergeChild(std::vector<Node>&,size_t childIndex);
-    static bool contains(const Node&,const Value&);
-    static void enumerate(const Node&,const std::function<void(const Value&)>&);
+    static size_t findChildIndexForValue(const Vector<Value> &keys,const Value &value);//last child with key<=value
+    template<typename Child>
+    static Vector<Child> &getChildren(Inner&);
+    static size_t getNodeSize(const Leaf&);
+    static size_t getNodeSize(const Inner&);
+    static const Value &getSmallestValueInNode(const Leaf&);
+    static const Value &getSmallestValueInNode(const Inner&);
+    static const Value &getLargestValueInNode(const Leaf&);
+    static const Value &getLargestValueInNode(const Inner&);
+    template<typename Child>
+    static void splitChild(Vector<Child>&,Vector<Value> &keys,size_t childIndex);
+    template<typename Child>
+    static void mergeChild(Vector<Child>&,Vector<Value> &keys,size_t childIndex);
+    static Leaf splitOff(Leaf&,size_t index);//returns elements starting from the index
+    static Inner splitOff(Inner&,size_t index);
+    static void append(Leaf &target,Leaf &&source);
+    static void append(Inner &target,Inner &&source);
+    template<typename Child>
+    void rebalanceChild(Vector<Child>&,Vector<Value> &keys,size_t childIndex) const;
+    template<typename Child>
+    bool borrowFromSibling(Vector<Child>&,Vector<Value> &keys,size_t childIndex) const;//false if siblings have nothing to spare
+    template<typename Item>
+    static void moveBetweenSiblings(Vector<Item> &left,Vector<Item> &right,size_t count,bool toLeft);
+    static void moveBetweenSiblings(Inner &left,Inner &right,size_t count,bool toLeft);
+    size_t getUnderflowChunkSize(bool isLeaf) const;
+    std::vector<size_t> getEvenChunkSizes(size_t count) const;
+    template<typename Child>
+    Vector<Inner> buildLevel(Vector<Value> &keys,Vector<Child> &&children) const;//keys are replaced with parents' ones
+    static bool contains(const Inner&,const Value&);
+    static void enumerate(const Inner&,const std::function<void(const Value&)>&);
+    static bool enumerateRange(const Inner&,const Value &from,const Value &to,const std::function<void(const Value&)>&);//false once to is reached
+    void addLeaves(const Inner&,LeafFill&) const;
+    bool isEmpty() const;
+    template<typename Child>
+    void setRoot(Vector<Value> &&keys,Vector<Child> &&children);
+    void split(Inner&&,const Value&,MultilevelHatWithCachedSmallest &left,MultilevelHatWithCachedSmallest &right) const;
+    static MultilevelHatWithCachedSmallest joinTrees(MultilevelHatWithCachedSmallest &&left,MultilevelHatWithCachedSmallest &&right);
+    void attachRight(Inner&,size_t heightDifference,Inner &&right) const;
+    void attachLeft(Inner&,size_t heightDifference,Inner &&left) const;
+    static size_t getHeight(const Inner&);
+    static size_t getValueCount(const Inner&);
 };
 ///////////////////////////////////////////////////////////////////////////////
-template<typename Value>
-MultilevelHatWithCachedSmallest<Value>::MultilevelHatWithCachedSmallest(size_t minChunkSize,size_t maxChunkSize)
+template<typename Value,typename Allocator,typename Statistics>
+MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::MultilevelHatWithCachedSmallest(
+    size_t minChunkSize,
+    size_t maxChunkSize,
+    size_t underflowSlack)
     :minChunkSize_(minChunkSize)
     ,maxChunkSize_(maxChunkSize)
+    ,underflowSlack_(underflowSlack)
 {}
-template<typename Value>
-void MultilevelHatWithCachedSmallest<Value>::insert(const Value &value)
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::insert(const Value &value)
+{
+    Statistics::add(Counter::insertion);
+    if(first_.empty() || !(first_.front()<value))
+    {
+        insertIntoLeaf(first_,findIndexInFirst(first_,value),value);
+        if(first_.size()>maxChunkSize_)
+            spillFirst();
+    }
+    else if(last_.empty() || !(value<last_.front()))
+    {//last_ is empty only when the tree is
+        insertIntoLeaf(last_,findIndexForValue(last_,value),value);
+        if(last_.size()>maxChunkSize_)
+            spillLast();
+    }
+    else
+        insertIntoTree(value);
+}
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::erase(const Value &value)
+{
+    if(!first_.empty() && !(first_.front()<value))
+    {
+        eraseFromLeaf(first_,findIndexInFirst(first_,value),value);
+        if(first_.empty())
+            refillFirst();
+    }
+    else if(!last_.empty() && !(value<last_.front()))
+    {
+        eraseFromLeaf(last_,findIndexForValue(last_,value),value);
+        if(last_.empty())
+            refillLast();
+    }
+    else
+        eraseFromTree(value);
+}
+template<typename Value,typename Allocator,typename Statistics>
+size_t MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::eraseRange(const Value &from,const Value &to)
+{
+    if(!(from<to))
+        return 0;
+    const auto lowerBound=from,upperBound=to;//the arguments may refer to values of this container
+    auto count=eraseRangeFromEnds(lowerBound,upperBound);
+    if(!isEmpty())
+    {
+        MultilevelHatWithCachedSmallest lower(minChunkSize_,maxChunkSize_,underflowSlack_),rest(minChunkSize_,maxChunkSize_,underflowSlack_);
+        MultilevelHatWithCachedSmallest middle(minChunkSize_,maxChunkSize_,underflowSlack_),upper(minChunkSize_,maxChunkSize_,underflowSlack_);
+        split(std::move(root_),lowerBound,lower,rest);
+        if(!rest.isEmpty())
+            split(std::move(rest.root_),upperBound,middle,upper);
+        count+=getValueCount(middle.root_);
+        root_=std::move(joinTrees(std::move(lower),std::move(upper)).root_);
+    }
+    if(first_.empty())
+        refillFirst();
+    if(last_.empty())
+        refillLast();
+    return count;
+}
+template<typename Value,typename Allocator,typename Statistics>
+size_t MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::eraseIf(const std::function<bool(const Value&)> &predicate)
+{
+    attachEnds();
+    Leaf values;
+    size_t erasedCount=0;
+    enumerate(root_,[&](const Value &value)
+    {
+        if(predicate(value))
+            ++erasedCount;
+        else
+            values.push_back(value);
+    });
+    if(erasedCount>0)
+        rebuild(std::move(values));
+    detachEnds();
+    return erasedCount;
+}
+template<typename Value,typename Allocator,typename Statistics>
+bool MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::contains(const Value &value) const
+{
+    Statistics::add(Counter::lookup);
+    if(!first_.empty() && !(first_.front()<value))
+    {
+        Statistics::add(Counter::visitedNode);
+        const auto index=findIndexInFirst(first_,value);
+        return index<first_.size() && first_[index]==value;
+    }
+    if(!last_.empty() && !(value<last_.front()))
+    {
+        Statistics::add(Counter::visitedNode);
+        const auto index=findIndexForValue(last_,value);
+        return index<last_.size() && last_[index]==value;
+    }
+    return !isEmpty() && contains(root_,value);
+}
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::enumerate(const std::function<void(const Value&)> &processor) const
+{
+    for(auto value=first_.rbegin();value!=first_.rend();++value)
+        processor(*value);
+    enumerate(root_,processor);
+    for(const auto &value:last_)
+        processor(value);
+}
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::enumerateRange(
+    const Value &from,
+    const Value &to,
+    const std::function<void(const Value&)> &processor) const
+{
+    for(auto value=first_.rbegin();value!=first_.rend() && *value<to;++value)
+        if(!(*value<from))
+            processor(*value);
+    if(!enumerateRange(root_,from,to,processor))
+        return;
+    for(auto value=last_.begin()+findIndexForValue(last_,from);value!=last_.end() && *value<to;++value)
+        processor(*value);
+}
+template<typename Value,typename Allocator,typename Statistics>
+const Value &MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::min() const
+{
+    if(first_.empty())
+        throw std::logic_error("the container is empty");
+    return first_.back();
+}
+template<typename Value,typename Allocator,typename Statistics>
+const Value &MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::max() const
+{
+    if(first_.empty())
+        throw std::logic_error("the container is empty");
+    return (last_.empty()?first_.front():last_.back());
+}
+template<typename Value,typename Allocator,typename Statistics>
+Value MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::popMin()
+{
+    if(first_.empty())
+        throw std::logic_error("the container is empty");
+    auto value=std::move(first_.back());
+    first_.pop_back();
+    if(first_.empty())
+        refillFirst();
+    return value;
+}
+template<typename Value,typename Allocator,typename Statistics>
+Value MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::popMax()
+{
+    if(first_.empty())
+        throw std::logic_error("the container is empty");
+    if(last_.empty())
+    {//all values are in first_, which is no longer than a leaf
+        auto value=std::move(first_.front());
+        first_.erase(first_.begin());
+        return value;
+    }
+    auto value=std::move(last_.back());
+    last_.pop_back();
+    if(last_.empty())
+        refillLast();
+    return value;
+}
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::setChunkSizes(size_t minChunkSize,size_t maxChunkSize)
+{
+    minChunkSize_=minChunkSize;
+    maxChunkSize_=maxChunkSize;
+}
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::compact()
+{//the outermost leaves stay as they are
+    Leaf values;
+    enumerate(root_,[&](const Value &value){values.push_back(value);});
+    rebuild(std::move(values));
+}
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::rebuild(Leaf &&values)
+{
+    Vector<Value> keys;
+    Vector<Leaf> leaves;
+    size_t position=0;
+    for(const auto size:getEvenChunkSizes(values.size()))
+    {
+        if(size==0)
+            break;
+        keys.push_back(values[position]);
+        leaves.emplace_back(
+            std::make_move_iterator(values.begin()+position),
+            std::make_move_iterator(values.begin()+position+size));
+        position+=size;
+    }
+    if(leaves.size()<=maxChunkSize_)
+    {
+        setRoot(std::move(keys),std::move(leaves));
+        return;
+    }
+    auto nodes=buildLevel(keys,std::move(leaves));
+    while(nodes.size()>maxChunkSize_)
+        nodes=buildLevel(keys,std::move(nodes));
+    setRoot(std::move(keys),std::move(nodes));
+}
+template<typename Value,typename Allocator,typename Statistics>
+std::pair<MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>,MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>>
+    MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::split(MultilevelHatWithCachedSmallest &&container,const Value &value)
+{
+    MultilevelHatWithCachedSmallest left(container.minChunkSize_,container.maxChunkSize_,container.underflowSlack_);
+    MultilevelHatWithCachedSmallest right(container.minChunkSize_,container.maxChunkSize_,container.underflowSlack_);
+    container.attachEnds();
+    if(!container.isEmpty())
+        container.split(std::move(container.root_),value,left,right);
+    container.root_=Inner();
+    left.detachEnds();
+    right.detachEnds();
+    return {std::move(left),std::move(right)};
+}
+template<typename Value,typename Allocator,typename Statistics>
+MultilevelHatWithCachedSmallest<Value,Allocator,Statistics> MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::join(
+    MultilevelHatWithCachedSmallest &&left,
+    MultilevelHatWithCachedSmallest &&right)
+{
+    if(left.first_.empty())
+        return std::move(right);
+    if(right.first_.empty())
+        return std::move(left);
+    if(!(left.max()<right.min()))
+        throw std::logic_error("joined containers overlap");
+    left.attachEnds();
+    right.attachEnds();
+    auto result=joinTrees(std::move(left),std::move(right));
+    result.detachEnds();
+    return result;
+}
+template<typename Value,typename Allocator,typename Statistics>
+MultilevelHatWithCachedSmallest<Value,Allocator,Statistics> MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::joinTrees(
+    MultilevelHatWithCachedSmallest &&left,
+    MultilevelHatWithCachedSmallest &&right)
+{//the lower tree becomes a child of the higher one at the matching level
+    if(left.isEmpty())
+        return std::move(right);
+    if(right.isEmpty())
+        return std::move(left);
+    const auto leftHeight=getHeight(left.root_);
+    const auto rightHeight=getHeight(right.root_);
+    MultilevelHatWithCachedSmallest result(left.minChunkSize_,left.maxChunkSize_,left.underflowSlack_);
+    if(leftHeight==rightHeight)
+    {
+        auto &keys=result.root_.keys_;
+        auto &children=result.root_.children_;
+        keys.push_back(getSmallestValueInNode(left.root_));
+        keys.push_back(getSmallestValueInNode(right.root_));
+        children.push_back(std::move(left.root_));
+        children.push_back(std::move(right.root_));
+        result.rebalanceChild(children,keys,0);
+        if(children.size()>1)
+            result.rebalanceChild(children,keys,1);
+    }
+    else if(leftHeight>rightHeight)
+    {
+        result.root_=std::move(left.root_);
+        result.attachRight(result.root_,leftHeight-rightHeight,std::move(right.root_));
+    }
+    else
+    {
+        result.root_=std::move(right.root_);
+        result.attachLeft(result.root_,rightHeight-leftHeight,std::move(left.root_));
+    }
+    result.decreaseDepthIfNeeded();
+    result.increaseDepthIfNeeded();
+    return result;
+}
+template<typename Value,typename Allocator,typename Statistics>
+LeafFill MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::statistics() const
+{
+    LeafFill fill;
+    if(!first_.empty())
+        fill.addLeaf(first_.size(),maxChunkSize_);
+    addLeaves(root_,fill);
+    if(!last_.empty())
+        fill.addLeaf(last_.size(),maxChunkSize_);
+    return fill;
+}
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::insertIntoTree(const Value &value)
 {
+    if(isEmpty())
+    {
+        root_.keys_.push_back(value);
+        root_.leaves_.push_back(Leaf{value});
+        return;
+    }
     insert(value,root_);
     increaseDepthIfNeeded();
 }
-template<typename Value>
-void MultilevelHatWithCachedSmallest<Value>::erase(const Value &value)
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::eraseFromTree(const Value &value)
 {
+    if(isEmpty())
+        return;
     erase(value,root_);
     decreaseDepthIfNeeded();
 }
-template<typename Value>
-bool MultilevelHatWithCachedSmallest<Value>::contains(const Value &value) const
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::insert(const Value &value,Inner &node)
 {
-    return contains(root_,value);
+    const auto index=findChildIndexForValue(node.keys_,value);
+    if(node.children_.empty())
+    {
+        auto &leaf=node.leaves_[index];
+        const auto valueIndex=findIndexForValue(leaf,value);
+        if(valueIndex==leaf.size() || leaf[valueIndex]!=value)
+        {
+            Statistics::add(Counter::movedValue,leaf.size()-valueIndex);
+            leaf.insert(leaf.begin()+valueIndex,value);
+        }
+        node.keys_[index]=leaf.front();
+        if(leaf.size()>maxChunkSize_)
+            splitChild(node.leaves_,node.keys_,index);
+    }
+    else
+    {
+        auto &child=node.children_[index];
+        insert(value,child);
+        node.keys_[index]=child.keys_.front();
+        if(getNodeSize(child)>maxChunkSize_)
+            splitChild(node.children_,node.keys_,index);
+    }
 }
-template<typename Value>
-void MultilevelHatWithCachedSmallest<Value>::enumerate(const std::function<void(const Value&)> &processor) const
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::increaseDepthIfNeeded()
 {
-    enumerate(root_,processor);
+    if(getNodeSize(root_)<=maxChunkSize_)
+        return;
+    Statistics::add(Counter::depthIncrease);
+    Inner newRoot;
+    newRoot.keys_.push_back(root_.keys_.front());
+    newRoot.children_.push_back(std::move(root_));
+    splitChild(newRoot.children_,newRoot.keys_,0);
+    root_=std::move(newRoot);
 }
-template<typename Value>
-void MultilevelHatWithCachedSmallest<Value>::insert(const Value &value,Node &node)
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::erase(const Value &value,Inner &node)
 {
-    if(auto *leaf=std::get_if<Leaf>(&node.content_))
+    const auto index=findChildIndexForValue(node.keys_,value);
+    if(node.children_.empty())
     {
-        leaf->insert(leaf->begin()+findIndexForValue(*leaf,value),value);
-        node.smallest_=leaf->front();
+        auto &leaf=node.leaves_[index];
+        const auto valueIndex=findIndexForValue(leaf,value);
+        if(valueIndex!=leaf.size() && leaf[valueIndex]==value)
+            leaf.erase(leaf.begin()+valueIndex);
+        rebalanceChild(node.leaves_,node.keys_,index);
     }
-    else if(auto *children=std::get_if<std::vector<Node>>(&node.content_))
+    else
     {
-        const auto index=findChildIndexForValue(*children,value);
-        insert(value,(*children)[index]);
-        node.smallest_=children->front().smallest_;
-        if(getNodeSize((*children)[index])>maxChunkSize_)
-            splitChild(*children,index);
+        erase(value,node.children_[index]);
+        rebalanceChild(node.children_,node.keys_,index);
     }
 }
-template<typename Value>
-void MultilevelHatWithCachedSmallest<Value>::increaseDepthIfNeeded()
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::decreaseDepthIfNeeded()
 {
-    if(getNodeSize(root_)<=maxChunkSize_)
+    while(root_.children_.size()==1)
+    {
+        Statistics::add(Counter::depthDecrease);
+        auto newRoot=std::move(root_.children_.front());
+        root_=std::move(newRoot);
+    }
+    if(root_.leaves_.size()==1 && root_.leaves_.front().empty())
+        root_=Inner();
+}
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::refillFirst()
+{//the next leaf comes from the tree, or last_ is all that is left
+    if(!isEmpty())
+    {
+        detachFirstLeaf(root_,first_);
+        decreaseDepthIfNeeded();
+    }
+    else
+    {
+        first_.assign(std::make_move_iterator(last_.rbegin()),std::make_move_iterator(last_.rend()));
+        last_.clear();
+    }
+}
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::refillLast()
+{
+    if(isEmpty())
         return;
-    auto smallest=root_.smallest_;
-    std::vector<Node> newRootChildren;
-    newRootChildren.push_back(std::move(root_));
-    splitChild(newRootChildren,0);
-    root_.content_=std::move(newRootChildren);
-    root_.smallest_=std::move(smallest);
-}
-template<typename Value>
-void MultilevelHatWithCachedSmallest<Value>::erase(const Value &value,Node &node)
-{
-    if(auto *leaf=std::get_if<Leaf>(&node.content_))
-    {
-        const auto index=findIndexForValue(*leaf,value);
-        if(index!=leaf->size() && (*leaf)[index]==value)
-            leaf->erase(leaf->begin()+index);
-        if(!leaf->empty())
-            node.smallest_=leaf->front();
-    }
-    else if(auto *children=std::get_if<std::vector<Node>>(&node.content_))
-    {
-        const auto index=findChildIndexForValue(*children,value);
-        erase(value,(*children)[index]);
-        node.smallest_=children->front().smallest_;
-        if(getNodeSize((*children)[index])<minChunkSize_)
-        {
-            mergeChild(*children,index);
-            if(index<children->size() && getNodeSize((*children)[index])>maxChunkSize_)
-                splitChild(*children,index);
-            else//we might merge to the previous node
-                if(index>0 && getNodeSize((*children)[index-1])>maxChunkSize_)
-                    splitChild(*children,index-1);
-        }
+    detachLastLeaf(root_,last_);
+    decreaseDepthIfNeeded();
+}
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::spillFirst()
+{//the larger half becomes the first leaf of the tree, or last_ if there is no tree
+    const auto count=first_.size()/2;
+    Leaf values(std::make_move_iterator(first_.rend()-count),std::make_move_iterator(first_.rend()));
+    first_.erase(first_.begin(),first_.begin()+count);
+    if(last_.empty())
+        last_=std::move(values);
+    else
+        insertFirst(std::move(values));
+}
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::spillLast()
+{
+    const auto count=last_.size()/2;
+    Leaf values(std::make_move_iterator(last_.begin()),std::make_move_iterator(last_.begin()+count));
+    last_.erase(last_.begin(),last_.begin()+count);
+    insertLast(std::move(values));
+}
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::attachEnds()
+{
+    if(!first_.empty())
+    {
+        Leaf values(std::make_move_iterator(first_.rbegin()),std::make_move_iterator(first_.rend()));
+        first_.clear();
+        insertFirst(std::move(values));
     }
+    if(!last_.empty())
+    {
+        insertLast(std::move(last_));
+        last_.clear();
+    }
+}
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::detachEnds()
+{
+    refillFirst();
+    refillLast();
 }
-template<typename Value>
-void MultilevelHatWithCachedSmallest<Value>::decreaseDepthIfNeeded()
+template<typename Value,typename Allocator,typename Statistics>
+size_t MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::getValueCount() const
 {
-    if(auto *children=std::get_if<std::vector<Node>>(&root_.content_))
+    return first_.size()+getValueCount(root_)+last_.size();
+}
+template<typename Value,typename Allocator,typename Statistics>
+size_t MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::eraseRangeFromEnds(const Value &from,const Value &to)
+{
+    size_t count=0;
+    const auto descending=[](const Value &left,const Value &right){return right<left;};
+    const auto firstEnd=std::upper_bound(first_.begin(),first_.end(),from,descending);
+    const auto firstBegin=std::upper_bound(first_.begin(),firstEnd,to,descending);
+    count+=size_t(firstEnd-firstBegin);
+    first_.erase(firstBegin,firstEnd);
+    const auto lastBegin=std::lower_bound(last_.begin(),last_.end(),from);
+    const auto lastEnd=std::lower_bound(lastBegin,last_.end(),to);
+    count+=size_t(lastEnd-lastBegin);
+    last_.erase(lastBegin,lastEnd);
+    return count;
+}
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::detachFirstLeaf(Inner &node,Leaf &values) const
+{//no comparisons on the way down; a node left with a single child is rebalanced by its parent
+    if(node.children_.empty())
     {
-        if(children->size()==1)
-        {
-            auto newRoot=Node(std::move(children->front()));
-            root_=std::move(newRoot);
-        }
+        auto &leaf=node.leaves_.front();
+        std::move(leaf.rbegin(),leaf.rend(),std::back_inserter(values));
+        node.leaves_.erase(node.leaves_.begin());
+        node.keys_.erase(node.keys_.begin());
+        return;
+    }
+    detachFirstLeaf(node.children_.front(),values);
+    rebalanceChild(node.children_,node.keys_,0);
+}
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::detachLastLeaf(Inner &node,Leaf &values) const
+{
+    if(node.children_.empty())
+    {
+        auto &leaf=node.leaves_.back();
+        std::move(leaf.begin(),leaf.end(),std::back_inserter(values));
+        node.leaves_.pop_back();
+        node.keys_.pop_back();
+        return;
     }
+    detachLastLeaf(node.children_.back(),values);
+    rebalanceChild(node.children_,node.keys_,node.children_.size()-1);
 }
-template<typename Value>
-size_t MultilevelHatWithCachedSmallest<Value>::findIndexForValue(const Leaf &leaf,const Value &value)
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::insertFirst(Leaf &&values)
+{
+    if(isEmpty())
+    {
+        Vector<Value> keys{values.front()};
+        Vector<Leaf> leaves;
+        leaves.push_back(std::move(values));
+        setRoot(std::move(keys),std::move(leaves));
+        return;
+    }
+    insertFirst(std::move(values),root_);
+    increaseDepthIfNeeded();
+}
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::insertLast(Leaf &&values)
+{
+    if(isEmpty())
+    {
+        Vector<Value> keys{values.front()};
+        Vector<Leaf> leaves;
+        leaves.push_back(std::move(values));
+        setRoot(std::move(keys),std::move(leaves));
+        return;
+    }
+    insertLast(std::move(values),root_);
+    increaseDepthIfNeeded();
+}
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::insertFirst(Leaf &&values,Inner &node) const
+{//an overfull leaf is at most twice as large as allowed, so a single split on each level is enough
+    if(node.children_.empty())
+    {
+        auto &leaf=node.leaves_.front();
+        Statistics::add(Counter::movedValue,leaf.size());
+        leaf.insert(leaf.begin(),std::make_move_iterator(values.begin()),std::make_move_iterator(values.end()));
+        node.keys_.front()=leaf.front();
+        if(leaf.size()>maxChunkSize_)
+            splitChild(node.leaves_,node.keys_,0);
+        return;
+    }
+    auto &child=node.children_.front();
+    insertFirst(std::move(values),child);
+    node.keys_.front()=child.keys_.front();
+    if(getNodeSize(child)>maxChunkSize_)
+        splitChild(node.children_,node.keys_,0);
+}
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::insertLast(Leaf &&values,Inner &node) const
+{
+    if(node.children_.empty())
+    {
+        auto &leaf=node.leaves_.back();
+        std::move(values.begin(),values.end(),std::back_inserter(leaf));
+        if(leaf.size()>maxChunkSize_)
+            splitChild(node.leaves_,node.keys_,node.leaves_.size()-1);
+        return;
+    }
+    auto &child=node.children_.back();
+    insertLast(std::move(values),child);
+    if(getNodeSize(child)>maxChunkSize_)
+        splitChild(node.children_,node.keys_,node.children_.size()-1);
+}
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::insertIntoLeaf(Leaf &leaf,size_t index,const Value &value)
+{
+    if(index<leaf.size() && leaf[index]==value)
+        return;//the value is already in the container
+    Statistics::add(Counter::movedValue,leaf.size()-index);
+    leaf.insert(leaf.begin()+index,value);
+}
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::eraseFromLeaf(Leaf &leaf,size_t index,const Value &value)
+{
+    if(index<leaf.size() && leaf[index]==value)
+        leaf.erase(leaf.begin()+index);
+}
+template<typename Value,typename Allocator,typename Statistics>
+size_t MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::findIndexInFirst(const Leaf &first,const Value &value)
+{//smallest values sit at the end, so popping and inserting them moves little
+    return size_t(std::lower_bound(first.begin(),first.end(),value,[](const Value &left,const Value &right){return right<left;})-first.begin());
+}
+template<typename Value,typename Allocator,typename Statistics>
+size_t MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::findIndexForValue(const Leaf &leaf,const Value &value)
 {
     size_t current=leaf.size();
     size_t step=leaf.size();
@@ -144,61 +709,75 @@ size_t MultilevelHatWithCachedSmallest<Value>::findIndexForValue(const Leaf &lea
     }
     return current;
 }
-template<typename Value>
-size_t MultilevelHatWithCachedSmallest<Value>::findChildIndexForValue(const std::vector<Node> &nodes,const Value &value)
-{
+template<typename Value,typename Allocator,typename Statistics>
+size_t MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::findChildIndexForValue(const Vector<Value> &keys,const Value &value)
+{//the number of steps depends only on the size, and the comparison result selects an index instead of a branch
     size_t current=0;
-    size_t step=nodes.size();
-    while(step>0)
+    size_t size=keys.size();
+    while(size>1)
     {
-        if(current+step>=nodes.size() || value<nodes[current+step].smallest_)
-            step/=2;
-        else
-            current+=step;
+        const auto half=size/2;
+        current=(value<keys[current+half]?current:current+half);
+        size-=half;
     }
     return current;
 }
-template<typename Value>
-size_t MultilevelHatWithCachedSmallest<Value>::getNodeSize(const Node &node)
+template<typename Value,typename Allocator,typename Statistics>
+template<typename Child>
+typename MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::template Vector<Child> &MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::getChildren(Inner &node)
 {
-    if(auto *leaf=std::get_if<Leaf>(&node.content_))
-        return leaf->size();
-    else if(auto *children=std::get_if<std::vector<Node>>(&node.content_))
-        return children->size();
+    if constexpr(std::is_same_v<Child,Leaf>)
+        return node.leaves_;
     else
-        throw std::logic_error("hmmmm... unknown node type");
+        return node.children_;
 }
-template<typename Value>
-void MultilevelHatWithCachedSmallest<Value>::splitChild(std::vector<Node> &nodes,size_t childIndex)
+template<typename Value,typename Allocator,typename Statistics>
+size_t MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::getNodeSize(const Leaf &leaf)
 {
-    Node newChild1,newChild2;
-    if(auto *leaf=std::get_if<Leaf>(&nodes[childIndex].content_))
-    {
-        const auto middle=leaf->begin()+leaf->size()/2;
-        Leaf firstHalf,secondHalf;
-        std::move(leaf->begin(),middle,std::back_inserter(firstHalf));
-        std::move(middle,leaf->end(),std::back_inserter(secondHalf));
-        newChild1.smallest_=firstHalf.front();
-        newChild1.content_=std::move(firstHalf);
-        newChild2.smallest_=secondHalf.front();
-        newChild2.content_=std::move(secondHalf);
-    }
-    else if(auto *children=std::get_if<std::vector<Node>>(&nodes[childIndex].content_))
-    {
-        const auto middle=children->begin()+children->size()/2;
-        std::vector<Node> firstHalf,secondHalf;
-        std::move(children->begin(),middle,std::back_inserter(firstHalf));
-        std::move(middle,children->end(),std::back_inserter(secondHalf));
-        newChild1.smallest_=firstHalf.front().smallest_;
-        newChild1.content_=std::move(firstHalf);
-        newChild2.smallest_=secondHalf.front().smallest_;
-        newChild2.content_=std::move(secondHalf);
-    }
-    nodes[childIndex]=std::move(newChild1);
-    nodes.insert(nodes.begin()+childIndex+1,std::move(newChild2));
+    return leaf.size();
+}
+template<typename Value,typename Allocator,typename Statistics>
+size_t MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::getNodeSize(const Inner &node)
+{
+    return node.keys_.size();
+}
+template<typename Value,typename Allocator,typename Statistics>
+const Value &MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::getSmallestValueInNode(const Leaf &leaf)
+{
+    return leaf.front();
+}
+template<typename Value,typename Allocator,typename Statistics>
+const Value &MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::getSmallestValueInNode(const Inner &node)
+{
+    return node.keys_.front();
+}
+template<typename Value,typename Allocator,typename Statistics>
+const Value &MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::getLargestValueInNode(const Leaf &leaf)
+{
+    return leaf.back();
+}
+template<typename Value,typename Allocator,typename Statistics>
+const Value &MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::getLargestValueInNode(const Inner &node)
+{
+    if(node.children_.empty())
+        return getLargestValueInNode(node.leaves_.back());
+    else
+        return getLargestValueInNode(node.children_.back());
 }
-template<typename Value>
-void MultilevelHatWithCachedSmallest<Value>::mergeChild(std::vector<Node> &nodes,size_t childIndex)
+template<typename Value,typename Allocator,typename Statistics>
+template<typename Child>
+void MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::splitChild(Vector<Child> &nodes,Vector<Value> &keys,size_t childIndex)
+{
+    const auto size=getNodeSize(nodes[childIndex]);
+    Statistics::add(Counter::split);
+    Statistics::add(Counter::movedValue,size-size/2);
+    auto secondHalf=splitOff(nodes[childIndex],size/2);
+    keys.insert(keys.begin()+childIndex+1,getSmallestValueInNode(secondHalf));
+    nodes.insert(nodes.begin()+childIndex+1,std::move(secondHalf));
+}
+template<typename Value,typename Allocator,typename Statistics>
+template<typename Child>
+void MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::mergeChild(Vector<Child> &nodes,Vector<Value> &keys,size_t childIndex)
 {
     if(childIndex>0)
     {//consider merging to the left node
@@ -207,49 +786,343 @@ void MultilevelHatWithCachedSmallest<Value>::mergeChild(std::vector<Node> &nodes
         else if(getNodeSize(nodes[childIndex-1])<getNodeSize(nodes[childIndex+1]))
             --childIndex;
     }
-    if(auto *sourceLeaf=std::get_if<Leaf>(&nodes[childIndex+1].content_))
+    Statistics::add(Counter::merge);
+    append(nodes[childIndex],std::move(nodes[childIndex+1]));
+    keys[childIndex]=getSmallestValueInNode(nodes[childIndex]);
+    nodes.erase(nodes.begin()+childIndex+1);
+    keys.erase(keys.begin()+childIndex+1);
+}
+template<typename Value,typename Allocator,typename Statistics>
+typename MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::Leaf MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::splitOff(
+    Leaf &leaf,
+    size_t index)
+{
+    Leaf secondHalf(std::make_move_iterator(leaf.begin()+index),std::make_move_iterator(leaf.end()));
+    leaf.erase(leaf.begin()+index,leaf.end());
+    return secondHalf;
+}
+template<typename Value,typename Allocator,typename Statistics>
+typename MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::Inner MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::splitOff(
+    Inner &node,
+    size_t index)
+{
+    Inner secondHalf;
+    secondHalf.keys_=splitOff(node.keys_,index);
+    if(node.children_.empty())
     {
-        auto *targetLeaf=std::get_if<Leaf>(&nodes[childIndex].content_);
-        if(!targetLeaf)
-            throw std::logic_error("AAAAAAAA!!!! PANIC!!!!!");
-        std::move(sourceLeaf->begin(),sourceLeaf->end(),std::back_inserter(*targetLeaf));
+        std::move(node.leaves_.begin()+index,node.leaves_.end(),std::back_inserter(secondHalf.leaves_));
+        node.leaves_.erase(node.leaves_.begin()+index,node.leaves_.end());
     }
-    if(auto *sourceChildren=std::get_if<std::vector<Node>>(&nodes[childIndex+1].content_))
+    else
     {
-        auto *targetChildren=std::get_if<std::vector<Node>>(&nodes[childIndex].content_);
-        if(!targetChildren)
-            throw std::logic_error("AAAAAAAA!!!! PANIC!!!!!");
-        std::move(sourceChildren->begin(),sourceChildren->end(),std::back_inserter(*targetChildren));
+        std::move(node.children_.begin()+index,node.children_.end(),std::back_inserter(secondHalf.children_));
+        node.children_.erase(node.children_.begin()+index,node.children_.end());
     }
-    nodes.erase(nodes.begin()+childIndex+1);
+    return secondHalf;
+}
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::append(Leaf &target,Leaf &&source)
+{
+    std::move(source.begin(),source.end(),std::back_inserter(target));
 }
-template<typename Value>
-bool MultilevelHatWithCachedSmallest<Value>::contains(const Node &node,const Value &value)
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::append(Inner &target,Inner &&source)
 {
-    if(auto *leaf=std::get_if<Leaf>(&node.content_))
+    if(target.children_.empty()!=source.children_.empty())
+        throw std::logic_error("merging nodes of different heights");
+    append(target.keys_,std::move(source.keys_));
+    std::move(source.leaves_.begin(),source.leaves_.end(),std::back_inserter(target.leaves_));
+    std::move(source.children_.begin(),source.children_.end(),std::back_inserter(target.children_));
+}
+template<typename Value,typename Allocator,typename Statistics>
+template<typename Child>
+void MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::rebalanceChild(
+    Vector<Child> &children,
+    Vector<Value> &keys,
+    size_t index) const
+{
+    if(getNodeSize(children[index])>0)
+        keys[index]=getSmallestValueInNode(children[index]);
+    if(getNodeSize(children[index])<getUnderflowChunkSize(std::is_same_v<Child,Leaf>) && children.size()>1)
     {
-        const auto index=findIndexForValue(*leaf,value);
-        return (index<leaf->size() && (*leaf)[index]==value);
+        if(borrowFromSibling(children,keys,index))
+            return;//moves only a few values and leaves both nodes away from the limits
+        mergeChild(children,keys,index);
+        if(index<children.size() && getNodeSize(children[index])>maxChunkSize_)
+            splitChild(children,keys,index);
+        else//we might merge to the previous node
+            if(index>0 && getNodeSize(children[index-1])>maxChunkSize_)
+                splitChild(children,keys,index-1);
     }
-    else if(auto *children=std::get_if<std::vector<Node>>(&node.content_))
+}
+template<typename Value,typename Allocator,typename Statistics>
+template<typename Child>
+bool MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::borrowFromSibling(
+    Vector<Child> &nodes,
+    Vector<Value> &keys,
+    size_t childIndex) const
+{//the larger neighbour gives values (or children) until both nodes have the same size
+    const bool hasLeft=(childIndex>0);
+    const bool hasRight=(childIndex+1<nodes.size());
+    const bool fromLeft=hasLeft
+        && (!hasRight || getNodeSize(nodes[childIndex-1])>getNodeSize(nodes[childIndex+1]));
+    const auto siblingIndex=(fromLeft?childIndex-1:childIndex+1);
+    const auto siblingSize=getNodeSize(nodes[siblingIndex]);
+    if(siblingSize<=minChunkSize_)
+        return false;
+    const auto count=(siblingSize-getNodeSize(nodes[childIndex]))/2;
+    const auto leftIndex=std::min(childIndex,siblingIndex);
+    moveBetweenSiblings(nodes[leftIndex],nodes[leftIndex+1],count,!fromLeft);
+    keys[leftIndex]=getSmallestValueInNode(nodes[leftIndex]);//the child might have been empty
+    keys[leftIndex+1]=getSmallestValueInNode(nodes[leftIndex+1]);
+    return true;
+}
+template<typename Value,typename Allocator,typename Statistics>
+template<typename Item>
+void MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::moveBetweenSiblings(
+    Vector<Item> &left,
+    Vector<Item> &right,
+    size_t count,
+    bool toLeft)
+{
+    if(toLeft)
     {
-        const auto index=findChildIndexForValue(*children,value);
-        return contains((*children)[index],value);
+        std::move(right.begin(),right.begin()+count,std::back_inserter(left));
+        right.erase(right.begin(),right.begin()+count);
     }
     else
-        throw std::logic_error("hmmm... unknown node type");
+    {
+        Vector<Item> items;
+        items.reserve(count+right.size());
+        std::move(left.end()-count,left.end(),std::back_inserter(items));
+        std::move(right.begin(),right.end(),std::back_inserter(items));
+        right=std::move(items);
+        left.erase(left.end()-count,left.end());
+    }
 }
-template<typename Value>
-void MultilevelHatWithCachedSmallest<Value>::enumerate(const Node &node,const std::function<void(const Value&)> &processor)
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::moveBetweenSiblings(Inner &left,Inner &right,size_t count,bool toLeft)
 {
-    if(auto *leaf=std::get_if<Leaf>(&node.content_))
+    moveBetweenSiblings(left.keys_,right.keys_,count,toLeft);
+    if(left.children_.empty())
+        moveBetweenSiblings(left.leaves_,right.leaves_,count,toLeft);
+    else
+        moveBetweenSiblings(left.children_,right.children_,count,toLeft);
+}
+template<typename Value,typename Allocator,typename Statistics>
+size_t MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::getUnderflowChunkSize(bool isLeaf) const
+{//leaves are never left empty and inner nodes keep at least two children, so every node has a smallest value
+    const auto size=(underflowSlack_<minChunkSize_?minChunkSize_-underflowSlack_:1);
+    return (isLeaf?size:std::max<size_t>(size,2));
+}
+template<typename Value,typename Allocator,typename Statistics>
+std::vector<size_t> MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::getEvenChunkSizes(size_t count) const
+{//sizes of consecutive chunks close to the middle of the allowed range
+    const auto targetChunkSize=std::max<size_t>((minChunkSize_+maxChunkSize_)/2,1);
+    auto chunkCount=std::max<size_t>((count+targetChunkSize/2)/targetChunkSize,1);
+    while(chunkCount>1 && count/chunkCount<minChunkSize_)
+        --chunkCount;
+    while((count+chunkCount-1)/chunkCount>maxChunkSize_)
+        ++chunkCount;
+    std::vector<size_t> sizes;
+    for(size_t index=0;index<chunkCount;++index)
+        sizes.push_back(count/chunkCount+(index<count%chunkCount?1:0));
+    return sizes;
+}
+template<typename Value,typename Allocator,typename Statistics>
+template<typename Child>
+typename MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::template Vector<typename MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::Inner> MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::buildLevel(
+    Vector<Value> &keys,
+    Vector<Child> &&children) const
+{
+    Vector<Inner> parents;
+    Vector<Value> parentKeys;
+    size_t position=0;
+    for(const auto size:getEvenChunkSizes(children.size()))
     {
-        for(const auto &value:*leaf)
+        Inner parent;
+        parent.keys_.assign(keys.begin()+position,keys.begin()+position+size);
+        std::move(
+            children.begin()+position,
+            children.begin()+position+size,
+            std::back_inserter(getChildren<Child>(parent)));
+        parentKeys.push_back(keys[position]);
+        parents.push_back(std::move(parent));
+        position+=size;
+    }
+    keys=std::move(parentKeys);
+    return parents;
+}
+template<typename Value,typename Allocator,typename Statistics>
+bool MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::contains(const Inner &node,const Value &value)
+{
+    Statistics::add(Counter::visitedNode);
+    const auto index=findChildIndexForValue(node.keys_,value);
+    if(node.children_.empty())
+    {
+        Statistics::add(Counter::visitedNode);//the leaf
+        const auto &leaf=node.leaves_[index];
+        const auto valueIndex=findIndexForValue(leaf,value);
+        return (valueIndex<leaf.size() && leaf[valueIndex]==value);
+    }
+    else
+        return contains(node.children_[index],value);
+}
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::enumerate(const Inner &node,const std::function<void(const Value&)> &processor)
+{
+    for(const auto &leaf:node.leaves_)
+        for(const auto &value:leaf)
             processor(value);
+    for(const auto &child:node.children_)
+        enumerate(child,processor);
+}
+template<typename Value,typename Allocator,typename Statistics>
+bool MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::enumerateRange(
+    const Inner &node,
+    const Value &from,
+    const Value &to,
+    const std::function<void(const Value&)> &processor)
+{//keys are the smallest values of children, so children starting at to or later are never entered
+    for(auto index=findChildIndexForValue(node.keys_,from);index<node.keys_.size();++index)
+    {
+        if(!(node.keys_[index]<to))
+            return false;
+        if(node.children_.empty())
+        {
+            const auto &leaf=node.leaves_[index];
+            for(auto value=leaf.begin()+findIndexForValue(leaf,from);value!=leaf.end();++value)
+            {
+                if(!(*value<to))
+                    return false;
+                processor(*value);
+            }
+        }
+        else if(!enumerateRange(node.children_[index],from,to,processor))
+            return false;
+    }
+    return true;
+}
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::addLeaves(const Inner &node,LeafFill &fill) const
+{
+    for(const auto &leaf:node.leaves_)
+        fill.addLeaf(leaf.size(),maxChunkSize_);
+    for(const auto &child:node.children_)
+        addLeaves(child,fill);
+}
+template<typename Value,typename Allocator,typename Statistics>
+bool MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::isEmpty() const
+{
+    return root_.keys_.empty();
+}
+template<typename Value,typename Allocator,typename Statistics>
+template<typename Child>
+void MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::setRoot(Vector<Value> &&keys,Vector<Child> &&children)
+{
+    root_=Inner();
+    if(children.empty())
+        return;
+    root_.keys_=std::move(keys);
+    getChildren<Child>(root_)=std::move(children);
+    decreaseDepthIfNeeded();
+}
+template<typename Value,typename Allocator,typename Statistics>
+size_t MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::getValueCount(const Inner &node)
+{
+    size_t count=0;
+    for(const auto &leaf:node.leaves_)
+        count+=leaf.size();
+    for(const auto &child:node.children_)
+        count+=getValueCount(child);
+    return count;
+}
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::split(
+    Inner &&node,
+    const Value &value,
+    MultilevelHatWithCachedSmallest &left,
+    MultilevelHatWithCachedSmallest &right) const
+{//the path to the value is cut, subtrees on each side are joined back
+    const auto index=findChildIndexForValue(node.keys_,value);
+    MultilevelHatWithCachedSmallest leftPart(minChunkSize_,maxChunkSize_,underflowSlack_);
+    MultilevelHatWithCachedSmallest rightPart(minChunkSize_,maxChunkSize_,underflowSlack_);
+    MultilevelHatWithCachedSmallest leftSiblings(minChunkSize_,maxChunkSize_,underflowSlack_);
+    MultilevelHatWithCachedSmallest rightSiblings(minChunkSize_,maxChunkSize_,underflowSlack_);
+    const auto takeSiblings=[&](auto &children)
+    {
+        using Children=std::remove_reference_t<decltype(children)>;
+        leftSiblings.setRoot(
+            Vector<Value>(node.keys_.begin(),node.keys_.begin()+index),
+            Children(std::make_move_iterator(children.begin()),std::make_move_iterator(children.begin()+index)));
+        rightSiblings.setRoot(
+            Vector<Value>(node.keys_.begin()+index+1,node.keys_.end()),
+            Children(std::make_move_iterator(children.begin()+index+1),std::make_move_iterator(children.end())));
+    };
+    if(node.children_.empty())
+    {
+        auto &leaf=node.leaves_[index];
+        auto secondHalf=splitOff(leaf,findIndexForValue(leaf,value));
+        if(!leaf.empty())
+        {
+            Vector<Value> keys{leaf.front()};//before the leaf is moved away
+            leftPart.setRoot(std::move(keys),Vector<Leaf>{std::move(leaf)});
+        }
+        if(!secondHalf.empty())
+        {
+            Vector<Value> keys{secondHalf.front()};
+            rightPart.setRoot(std::move(keys),Vector<Leaf>{std::move(secondHalf)});
+        }
+        takeSiblings(node.leaves_);
     }
-    else if(auto *children=std::get_if<std::vector<Node>>(&node.content_))
+    else
     {
-        for(const auto &node:*children)
-            enumerate(node,processor);
+        split(std::move(node.children_[index]),value,leftPart,rightPart);
+        takeSiblings(node.children_);
     }
+    left=joinTrees(std::move(leftSiblings),std::move(leftPart));
+    right=joinTrees(std::move(rightPart),std::move(rightSiblings));
+}
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::attachRight(Inner &node,size_t heightDifference,Inner &&right) const
+{
+    auto &children=node.children_;
+    if(heightDifference==1)
+    {
+        node.keys_.push_back(getSmallestValueInNode(right));
+        children.push_back(std::move(right));
+        rebalanceChild(children,node.keys_,children.size()-1);
+    }
+    else
+    {
+        attachRight(children.back(),heightDifference-1,std::move(right));
+        if(getNodeSize(children.back())>maxChunkSize_)
+            splitChild(children,node.keys_,children.size()-1);
+    }
+}
+template<typename Value,typename Allocator,typename Statistics>
+void MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::attachLeft(Inner &node,size_t heightDifference,Inner &&left) const
+{
+    auto &children=node.children_;
+    if(heightDifference==1)
+    {
+        node.keys_.insert(node.keys_.begin(),getSmallestValueInNode(left));
+        children.insert(children.begin(),std::move(left));
+        rebalanceChild(children,node.keys_,0);
+    }
+    else
+    {
+        attachLeft(children.front(),heightDifference-1,std::move(left));
+        node.keys_.front()=getSmallestValueInNode(children.front());
+        if(getNodeSize(children.front())>maxChunkSize_)
+            splitChild(children,node.keys_,0);
+    }
+}
+template<typename Value,typename Allocator,typename Statistics>
+size_t MultilevelHatWithCachedSmallest<Value,Allocator,Statistics>::getHeight(const Inner &node)
+{
+    if(node.children_.empty())
+        return 1;
+    else
+        return getHeight(node.children_.front())+1;
 }
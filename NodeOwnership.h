@@ -0,0 +1,105 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <utility>
+//how a tree holds its child nodes, given to it as a policy; both are used as pointers, so the tree's code is the same
+//OwnedNodes keeps children by value, so copying a tree copies all of its nodes
+struct OwnedNodes
+{
+    template<typename Node,typename Allocator>
+    class Pointer
+    {
+    public:
+        Pointer()=default;
+        Pointer(Node&&);
+        const Node &operator*() const;
+        const Node *operator->() const;
+        Node &operator*();
+        Node *operator->();
+    private:
+        Node node_;
+    };
+};
+//SharedNodes keeps children reference-counted and shared between copies of a tree (copy-on-write): a node is copied
+//only when it's about to be changed through a tree while another copy can see it, so a write copies the nodes
+//on its path and nothing else; reading through a const tree never copies, so copies can be read from other threads
+//while the original keeps changing, and a node is released with the last copy which references it
+struct SharedNodes
+{
+    template<typename Node,typename Allocator>
+    class Pointer
+    {
+    public:
+        Pointer();
+        Pointer(Node&&);
+        const Node &operator*() const;
+        const Node *operator->() const;
+        Node &operator*();//copies the node first if another copy can see it
+        Node *operator->();
+    private:
+        std::shared_ptr<Node> node_;
+        Node &makeWritable();
+    };
+};
+///////////////////////////////////////////////////////////////////////////////
+template<typename Node,typename Allocator>
+OwnedNodes::Pointer<Node,Allocator>::Pointer(Node &&node)
+    :node_(std::move(node))
+{}
+template<typename Node,typename Allocator>
+const Node &OwnedNodes::Pointer<Node,Allocator>::operator*() const
+{
+    return node_;
+}
+template<typename Node,typename Allocator>
+const Node *OwnedNodes::Pointer<Node,Allocator>::operator->() const
+{
+    return &node_;
+}
+template<typename Node,typename Allocator>
+Node &OwnedNodes::Pointer<Node,Allocator>::operator*()
+{
+    return node_;
+}
+template<typename Node,typename Allocator>
+Node *OwnedNodes::Pointer<Node,Allocator>::operator->()
+{
+    return &node_;
+}
+template<typename Node,typename Allocator>
+SharedNodes::Pointer<Node,Allocator>::Pointer()
+    :node_(std::allocate_shared<Node>(Allocator()))
+{}
+template<typename Node,typename Allocator>
+SharedNodes::Pointer<Node,Allocator>::Pointer(Node &&node)
+    :node_(std::allocate_shared<Node>(Allocator(),std::move(node)))
+{}
+template<typename Node,typename Allocator>
+const Node &SharedNodes::Pointer<Node,Allocator>::operator*() const
+{
+    return *node_;
+}
+template<typename Node,typename Allocator>
+const Node *SharedNodes::Pointer<Node,Allocator>::operator->() const
+{
+    return node_.get();
+}
+template<typename Node,typename Allocator>
+Node &SharedNodes::Pointer<Node,Allocator>::operator*()
+{
+    return makeWritable();
+}
+template<typename Node,typename Allocator>
+Node *SharedNodes::Pointer<Node,Allocator>::operator->()
+{
+    return &makeWritable();
+}
+template<typename Node,typename Allocator>
+Node &SharedNodes::Pointer<Node,Allocator>::makeWritable()
+{
+    if(node_.use_count()!=1)
+        node_=std::allocate_shared<Node>(Allocator(),std::as_const(*node_));//children are shared by both copies now
+    else//the last other copy might have just been released from another thread
+        std::atomic_thread_fence(std::memory_order_acquire);
+    return *node_;
+}
@@ -0,0 +1,9 @@
+#pragma once
+#include "BTree.h"
+#include "NodeOwnership.h"
+//BTree with nodes reference-counted and shared between copies, so snapshot() is O(maxChunkSize)
+//and a write copies only the nodes on its path which a snapshot still sees;
+//a snapshot can be read from any thread while the original keeps changing,
+//old nodes are released when the last snapshot referencing them goes away
+template<typename Value,typename Allocator=std::allocator<Value>,typename Statistics=NoStatistics>
+using PersistentBTree=BTree<Value,Allocator,Statistics,SharedNodes>;
@@ -0,0 +1,341 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <shared_mutex>
+#include <stdexcept>
+#include <thread>
+#include <tuple>
+#include <vector>
+//spreads values over several independent containers (e.g. BTree, MultilevelHatWithCachedSmallest),
+//each behind its own lock, so threads writing to different shards don't wait for each other;
+//inner containers must enumerate values in ascending order and have enumerateRange(), split() and join()
+template<typename Value,typename Inner>
+class ShardedSet
+{
+public:
+    class Iterator;
+    enum class Partitioning
+    {
+        hash,//even spread for any key distribution, ordered enumeration needs a k-way merge
+        range//shard i holds values from [boundaries[i-1],boundaries[i]), boundaries follow the data
+    };
+    ShardedSet(const Inner &prototype,size_t shardCount,Partitioning,std::vector<Value> boundaries={});
+    ShardedSet(const ShardedSet&);
+    void insert(const Value&);
+    void erase(const Value&);
+    bool contains(const Value&) const;
+    void enumerate(const std::function<void(const Value&)>&) const;//values are passed in ascending order
+    void enumerateRange(const Value &from,const Value &to,const std::function<void(const Value&)>&) const;//[from,to)
+    //range partitioning: moves boundaries so that shards get equal number of values, rebuilding all shards;
+    //inserts do it incrementally, by moving one boundary of the largest shard when it's skewed
+    void rebalance();
+private:
+    class SpinLock
+    {
+    public:
+        void lock();
+        void unlock();
+    private:
+        std::atomic_flag flag_=ATOMIC_FLAG_INIT;
+    };
+    struct Shard
+    {
+        Inner set_;
+        mutable SpinLock lock_;
+        size_t size_=0;//inserts minus erases, exact after the shard is counted, protected by lock_
+        explicit Shard(const Inner&);
+        Shard(const Shard&);
+    };
+    static const size_t rebalanceCheckInterval=1<<16;//inserts, doubled after each check which moved nothing
+    static const size_t skewFactor=2;//the largest shard compared to an average one
+    Inner prototype_;
+    Partitioning partitioning_;
+    std::vector<Shard> shards_;
+    std::vector<Value> boundaries_;
+    mutable std::shared_mutex boundariesMutex_;//shared by all operations, exclusive for rebalancing
+    std::atomic<size_t> insertsSinceRebalanceCheck_;
+    std::atomic<size_t> nextRebalanceCheck_;
+    std::shared_lock<std::shared_mutex> lockBoundaries() const;
+    size_t findShardIndex(const Value&) const;
+    static void merge(const std::vector<std::vector<Value>> &sortedShards,const std::function<void(const Value&)>&);
+    void rebalanceIfSkewed();
+    //boundariesMutex_ must be locked exclusively for these
+    bool moveBoundary(size_t shardIndex);//halves the size difference with the smaller neighbour, false if nothing moved
+    void redistribute();
+    static size_t hash(const Value&);
+};
+///////////////////////////////////////////////////////////////////////////////
+template<typename Value,typename Inner>
+void ShardedSet<Value,Inner>::SpinLock::lock()
+{
+    while(flag_.test_and_set(std::memory_order_acquire))
+        std::this_thread::yield();
+}
+template<typename Value,typename Inner>
+void ShardedSet<Value,Inner>::SpinLock::unlock()
+{
+    flag_.clear(std::memory_order_release);
+}
+template<typename Value,typename Inner>
+ShardedSet<Value,Inner>::Shard::Shard(const Inner &set)
+    :set_(set)
+{}
+template<typename Value,typename Inner>
+ShardedSet<Value,Inner>::Shard::Shard(const Shard &other)
+    :set_(other.set_)
+    ,size_(other.size_)
+{}
+template<typename Value,typename Inner>
+ShardedSet<Value,Inner>::ShardedSet(
+    const Inner &prototype,
+    size_t shardCount,
+    Partitioning partitioning,
+    std::vector<Value> boundaries)
+    :prototype_(prototype)
+    ,partitioning_(partitioning)
+    ,shards_(std::max<size_t>(shardCount,1),Shard(prototype))
+    ,boundaries_(std::move(boundaries))
+    ,insertsSinceRebalanceCheck_(0)
+    ,nextRebalanceCheck_(rebalanceCheckInterval)
+{
+    if(boundaries_.size()>=shards_.size())
+        throw std::logic_error("there should be less boundaries than shards");
+}
+template<typename Value,typename Inner>
+ShardedSet<Value,Inner>::ShardedSet(const ShardedSet &other)
+    :prototype_(other.prototype_)
+    ,partitioning_(other.partitioning_)
+    ,insertsSinceRebalanceCheck_(0)
+    ,nextRebalanceCheck_(rebalanceCheckInterval)
+{
+    std::unique_lock<std::shared_mutex> lock(other.boundariesMutex_);
+    shards_.reserve(other.shards_.size());
+    for(const auto &shard:other.shards_)
+    {
+        std::lock_guard<SpinLock> shardLock(shard.lock_);
+        shards_.push_back(shard);
+    }
+    boundaries_=other.boundaries_;
+}
+template<typename Value,typename Inner>
+void ShardedSet<Value,Inner>::insert(const Value &value)
+{
+    {
+        const auto boundariesLock=lockBoundaries();
+        auto &shard=shards_[findShardIndex(value)];
+        std::lock_guard<SpinLock> lock(shard.lock_);
+        shard.set_.insert(value);
+        ++shard.size_;
+    }
+    if(partitioning_==Partitioning::range
+        && ++insertsSinceRebalanceCheck_>=nextRebalanceCheck_.load(std::memory_order_relaxed))
+        rebalanceIfSkewed();
+}
+template<typename Value,typename Inner>
+void ShardedSet<Value,Inner>::erase(const Value &value)
+{
+    const auto boundariesLock=lockBoundaries();
+    auto &shard=shards_[findShardIndex(value)];
+    std::lock_guard<SpinLock> lock(shard.lock_);
+    shard.set_.erase(value);
+    if(shard.size_>0)
+        --shard.size_;
+}
+template<typename Value,typename Inner>
+bool ShardedSet<Value,Inner>::contains(const Value &value) const
+{
+    const auto boundariesLock=lockBoundaries();
+    const auto &shard=shards_[findShardIndex(value)];
+    std::lock_guard<SpinLock> lock(shard.lock_);
+    return shard.set_.contains(value);
+}
+template<typename Value,typename Inner>
+void ShardedSet<Value,Inner>::enumerate(const std::function<void(const Value&)> &processor) const
+{
+    if(partitioning_==Partitioning::range)
+    {//shards are already ordered
+        const auto boundariesLock=lockBoundaries();
+        for(const auto &shard:shards_)
+        {
+            std::lock_guard<SpinLock> lock(shard.lock_);
+            shard.set_.enumerate(processor);
+        }
+        return;
+    }
+    std::vector<std::vector<Value>> sortedShards(shards_.size());
+    for(size_t index=0;index<shards_.size();++index)
+    {
+        std::lock_guard<SpinLock> lock(shards_[index].lock_);
+        shards_[index].set_.enumerate([&](const Value &value){sortedShards[index].push_back(value);});
+    }
+    merge(sortedShards,processor);
+}
+template<typename Value,typename Inner>
+void ShardedSet<Value,Inner>::enumerateRange(
+    const Value &from,
+    const Value &to,
+    const std::function<void(const Value&)> &processor) const
+{
+    if(partitioning_==Partitioning::hash)
+    {//only values in the range are copied for the merge
+        std::vector<std::vector<Value>> sortedShards(shards_.size());
+        for(size_t index=0;index<shards_.size();++index)
+        {
+            std::lock_guard<SpinLock> lock(shards_[index].lock_);
+            shards_[index].set_.enumerateRange(from,to,[&](const Value &value){sortedShards[index].push_back(value);});
+        }
+        merge(sortedShards,processor);
+        return;
+    }
+    const auto boundariesLock=lockBoundaries();
+    const auto last=std::min(findShardIndex(to),shards_.size()-1);
+    for(auto index=findShardIndex(from);index<=last;++index)
+    {
+        std::lock_guard<SpinLock> lock(shards_[index].lock_);
+        shards_[index].set_.enumerateRange(from,to,processor);
+    }
+}
+template<typename Value,typename Inner>
+void ShardedSet<Value,Inner>::rebalance()
+{
+    if(partitioning_!=Partitioning::range)
+        return;
+    std::unique_lock<std::shared_mutex> lock(boundariesMutex_);
+    redistribute();
+}
+template<typename Value,typename Inner>
+std::shared_lock<std::shared_mutex> ShardedSet<Value,Inner>::lockBoundaries() const
+{
+    if(partitioning_==Partitioning::range)
+        return std::shared_lock<std::shared_mutex>(boundariesMutex_);
+    else//boundaries never change, don't pay for the shared counter
+        return std::shared_lock<std::shared_mutex>();
+}
+template<typename Value,typename Inner>
+size_t ShardedSet<Value,Inner>::findShardIndex(const Value &value) const
+{
+    if(partitioning_==Partitioning::hash)
+        return hash(value)%shards_.size();
+    else
+        return std::upper_bound(boundaries_.begin(),boundaries_.end(),value)-boundaries_.begin();
+}
+template<typename Value,typename Inner>
+void ShardedSet<Value,Inner>::merge(
+    const std::vector<std::vector<Value>> &sortedShards,
+    const std::function<void(const Value&)> &processor)
+{
+    using Cursor=std::tuple<Value,size_t,size_t>;//value, shard, position
+    const auto isLater=[](const Cursor &first,const Cursor &second){return std::get<0>(second)<std::get<0>(first);};
+    std::priority_queue<Cursor,std::vector<Cursor>,decltype(isLater)> heads(isLater);
+    for(size_t index=0;index<sortedShards.size();++index)
+        if(!sortedShards[index].empty())
+            heads.emplace(sortedShards[index].front(),index,0);
+    while(!heads.empty())
+    {
+        auto [value,shardIndex,position]=heads.top();
+        heads.pop();
+        processor(value);
+        if(++position<sortedShards[shardIndex].size())
+            heads.emplace(sortedShards[shardIndex][position],shardIndex,position);
+    }
+}
+template<typename Value,typename Inner>
+void ShardedSet<Value,Inner>::rebalanceIfSkewed()
+{//sizes are kept per shard, so a check costs O(shardCount) and a move O(size of the largest shard)
+    std::unique_lock<std::shared_mutex> lock(boundariesMutex_);
+    if(insertsSinceRebalanceCheck_<nextRebalanceCheck_)
+        return;//another thread has just checked
+    insertsSinceRebalanceCheck_=0;
+    size_t total=0,largest=0;
+    for(size_t index=0;index<shards_.size();++index)
+    {
+        total+=shards_[index].size_;
+        if(shards_[index].size_>shards_[largest].size_)
+            largest=index;
+    }
+    if(shards_[largest].size_*shards_.size()<=skewFactor*total)
+        return;
+    if(moveBoundary(largest))
+        nextRebalanceCheck_=rebalanceCheckInterval;
+    else//e.g. the size was overestimated after inserting duplicates, don't count it again on every check
+        nextRebalanceCheck_=2*nextRebalanceCheck_;
+}
+template<typename Value,typename Inner>
+bool ShardedSet<Value,Inner>::moveBoundary(size_t shardIndex)
+{//the shard is split once and a part is joined to the neighbour, other shards aren't touched
+    auto &shard=shards_[shardIndex];
+    shard.size_=0;
+    shard.set_.enumerate([&](const Value&){++shard.size_;});
+    const bool hasLeft=shardIndex>0;
+    const bool hasRight=shardIndex+1<shards_.size();//the shard after the last boundary is empty, it's used first
+    if(!hasLeft && !hasRight)
+        return false;
+    const bool toLeft=hasLeft && (!hasRight || shards_[shardIndex-1].size_<shards_[shardIndex+1].size_);
+    auto &neighbour=shards_[toLeft?shardIndex-1:shardIndex+1];
+    if(neighbour.size_>=shard.size_)
+        return false;
+    const auto count=(shard.size_-neighbour.size_)/2;//values to move
+    if(count==0)
+        return false;
+    const auto boundaryIndex=toLeft?count:shard.size_-count;
+    std::optional<Value> boundary;
+    size_t position=0;
+    shard.set_.enumerate([&](const Value &value)
+    {
+        if(position++==boundaryIndex)
+            boundary=value;
+    });
+    auto [lower,upper]=Inner::split(std::move(shard.set_),*boundary);
+    if(toLeft)
+    {
+        neighbour.set_=Inner::join(std::move(neighbour.set_),std::move(lower));
+        shard.set_=std::move(upper);
+        boundaries_[shardIndex-1]=std::move(*boundary);
+    }
+    else
+    {
+        neighbour.set_=Inner::join(std::move(upper),std::move(neighbour.set_));
+        shard.set_=std::move(lower);
+        if(shardIndex<boundaries_.size())
+            boundaries_[shardIndex]=std::move(*boundary);
+        else
+            boundaries_.push_back(std::move(*boundary));
+    }
+    shard.size_-=count;
+    neighbour.size_+=count;
+    return true;
+}
+template<typename Value,typename Inner>
+void ShardedSet<Value,Inner>::redistribute()
+{
+    std::vector<Value> values;
+    for(const auto &shard:shards_)
+        shard.set_.enumerate([&](const Value &value){values.push_back(value);});
+    if(values.empty())
+        return;
+    boundaries_.clear();
+    for(size_t index=1;index<shards_.size();++index)
+        boundaries_.push_back(values[index*values.size()/shards_.size()]);
+    for(auto &shard:shards_)
+    {
+        shard.set_=prototype_;
+        shard.size_=0;
+    }
+    for(const auto &value:values)
+    {
+        auto &shard=shards_[findShardIndex(value)];
+        shard.set_.insert(value);
+        ++shard.size_;
+    }
+}
+template<typename Value,typename Inner>
+size_t ShardedSet<Value,Inner>::hash(const Value &value)
+{//std::hash is often identity, so mix the bits to not map e.g. all even values to even shards
+    const auto mixed=static_cast<std::uint64_t>(std::hash<Value>()(value))*0x9E3779B97F4A7C15ull;
+    return static_cast<size_t>(mixed>>32);
+}
@@ -1,7 +1,9 @@
 #pragma once
 #include <functional>
+#include <memory>
 #include <vector>
-template<typename Value>
+#include "SortedSequences.h"
+template<typename Value,typename Allocator=std::allocator<Value>>
 class SortedArraySet
 {
 public:
@@ -10,39 +12,69 @@ public:
     void erase(const Value&);
     bool contains(const Value&) const;
     void enumerate(const std::function<void(const Value&)>&) const;
+    static SortedArraySet setUnion(const SortedArraySet&,const SortedArraySet&);
+    static SortedArraySet setIntersection(const SortedArraySet&,const SortedArraySet&);
+    static SortedArraySet setDifference(const SortedArraySet&,const SortedArraySet&);//values of the first set absent in the second one
+    void merge(const SortedArraySet&);
 private:
-    std::vector<Value> sortedArray_;
+    std::vector<Value,Allocator> sortedArray_;
     size_t findIndexForValue(const Value &value) const;//returns first element>=value
 };
 ///////////////////////////////////////////////////////////////////////////////
-template<typename Value>
-void SortedArraySet<Value>::insert(const Value &value)
+template<typename Value,typename Allocator>
+void SortedArraySet<Value,Allocator>::insert(const Value &value)
 {
     const auto index=findIndexForValue(value);
     if(index==sortedArray_.size() || sortedArray_[index]!=value)
         sortedArray_.insert(sortedArray_.begin()+index,value);
 }
-template<typename Value>
-void SortedArraySet<Value>::erase(const Value &value)
+template<typename Value,typename Allocator>
+void SortedArraySet<Value,Allocator>::erase(const Value &value)
 {
     const auto index=findIndexForValue(value);
     if(index<sortedArray_.size() && sortedArray_[index]==value)
         sortedArray_.erase(sortedArray_.begin()+index);
 }
-template<typename Value>
-bool SortedArraySet<Value>::contains(const Value &value) const
+template<typename Value,typename Allocator>
+bool SortedArraySet<Value,Allocator>::contains(const Value &value) const
 {
     const auto index=findIndexForValue(value);
     return (index<sortedArray_.size() && sortedArray_[index]==value);
 }
-template<typename Value>
-void SortedArraySet<Value>::enumerate(const std::function<void(const Value&)> &processor) const
+template<typename Value,typename Allocator>
+void SortedArraySet<Value,Allocator>::enumerate(const std::function<void(const Value&)> &processor) const
 {
     for(const auto &value:sortedArray_)
         processor(value);
 }
-template<typename Value>
-size_t SortedArraySet<Value>::findIndexForValue(const Value &value) const
+template<typename Value,typename Allocator>
+SortedArraySet<Value,Allocator> SortedArraySet<Value,Allocator>::setUnion(const SortedArraySet &first,const SortedArraySet &second)
+{
+    SortedArraySet result;
+    result.sortedArray_=uniteSorted(first.sortedArray_,second.sortedArray_);
+    return result;
+}
+template<typename Value,typename Allocator>
+SortedArraySet<Value,Allocator> SortedArraySet<Value,Allocator>::setIntersection(const SortedArraySet &first,const SortedArraySet &second)
+{
+    SortedArraySet result;
+    result.sortedArray_=intersectSorted(first.sortedArray_,second.sortedArray_);
+    return result;
+}
+template<typename Value,typename Allocator>
+SortedArraySet<Value,Allocator> SortedArraySet<Value,Allocator>::setDifference(const SortedArraySet &first,const SortedArraySet &second)
+{
+    SortedArraySet result;
+    result.sortedArray_=subtractSorted(first.sortedArray_,second.sortedArray_);
+    return result;
+}
+template<typename Value,typename Allocator>
+void SortedArraySet<Value,Allocator>::merge(const SortedArraySet &other)
+{
+    sortedArray_=uniteSorted(sortedArray_,other.sortedArray_);
+}
+template<typename Value,typename Allocator>
+size_t SortedArraySet<Value,Allocator>::findIndexForValue(const Value &value) const
 {
     size_t current=sortedArray_.size();
     size_t step=sortedArray_.size();
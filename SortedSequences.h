@@ -0,0 +1,120 @@
+#pragma once
+#include <algorithm>
+#include <vector>
+//set operations on sorted vectors of unique values;
+//when one side is much shorter, its values are looked up in the other one with exponential ("galloping") search,
+//so the cost is O(short*log(long/short)) instead of O(short+long)
+template<typename Value,typename Allocator>
+std::vector<Value,Allocator> intersectSorted(const std::vector<Value,Allocator>&,const std::vector<Value,Allocator>&);
+template<typename Value,typename Allocator>
+std::vector<Value,Allocator> uniteSorted(const std::vector<Value,Allocator>&,const std::vector<Value,Allocator>&);
+template<typename Value,typename Allocator>
+std::vector<Value,Allocator> subtractSorted(const std::vector<Value,Allocator>&,const std::vector<Value,Allocator>&);
+template<typename Value,typename Allocator>
+size_t gallop(const std::vector<Value,Allocator>&,size_t start,const Value&);//returns first element>=value at or after start
+const size_t gallopingRatio=16;//length ratio starting from which galloping beats the linear merge
+///////////////////////////////////////////////////////////////////////////////
+template<typename Value,typename Allocator>
+std::vector<Value,Allocator> intersectSorted(const std::vector<Value,Allocator> &first,const std::vector<Value,Allocator> &second)
+{
+    const auto &shorter=(first.size()<second.size()?first:second);
+    const auto &longer=(first.size()<second.size()?second:first);
+    std::vector<Value,Allocator> result;
+    if(shorter.size()*gallopingRatio<longer.size())
+    {
+        size_t position=0;
+        for(const auto &value:shorter)
+        {
+            position=gallop(longer,position,value);
+            if(position==longer.size())
+                break;
+            if(longer[position]==value)
+                result.push_back(value);
+        }
+    }
+    else
+    {//advancing without branching on the comparison result, it's unpredictable here
+        size_t firstIndex=0,secondIndex=0;
+        while(firstIndex<first.size() && secondIndex<second.size())
+        {
+            const auto &firstValue=first[firstIndex];
+            const auto &secondValue=second[secondIndex];
+            if(firstValue==secondValue)
+                result.push_back(firstValue);
+            firstIndex+=!(secondValue<firstValue);
+            secondIndex+=!(firstValue<secondValue);
+        }
+    }
+    return result;
+}
+template<typename Value,typename Allocator>
+std::vector<Value,Allocator> uniteSorted(const std::vector<Value,Allocator> &first,const std::vector<Value,Allocator> &second)
+{
+    const auto &shorter=(first.size()<second.size()?first:second);
+    const auto &longer=(first.size()<second.size()?second:first);
+    std::vector<Value,Allocator> result;
+    result.reserve(longer.size()+shorter.size());
+    if(shorter.size()*gallopingRatio<longer.size())
+    {//copy whole blocks of the longer sequence between values of the shorter one
+        size_t position=0;
+        for(const auto &value:shorter)
+        {
+            const auto next=gallop(longer,position,value);
+            result.insert(result.end(),longer.begin()+position,longer.begin()+next);
+            result.push_back(value);
+            position=next;
+            if(position<longer.size() && longer[position]==value)
+                ++position;
+        }
+        result.insert(result.end(),longer.begin()+position,longer.end());
+    }
+    else
+        std::set_union(first.begin(),first.end(),second.begin(),second.end(),std::back_inserter(result));
+    return result;
+}
+template<typename Value,typename Allocator>
+std::vector<Value,Allocator> subtractSorted(const std::vector<Value,Allocator> &first,const std::vector<Value,Allocator> &second)
+{
+    std::vector<Value,Allocator> result;
+    if(first.size()*gallopingRatio<second.size())
+    {//look up every value of the first sequence in the second one
+        size_t position=0;
+        for(const auto &value:first)
+        {
+            position=gallop(second,position,value);
+            if(position==second.size() || second[position]!=value)
+                result.push_back(value);
+        }
+    }
+    else if(second.size()*gallopingRatio<first.size())
+    {//copy whole blocks of the first sequence between values of the second one
+        size_t position=0;
+        for(const auto &value:second)
+        {
+            const auto next=gallop(first,position,value);
+            result.insert(result.end(),first.begin()+position,first.begin()+next);
+            position=next;
+            if(position<first.size() && first[position]==value)
+                ++position;
+        }
+        result.insert(result.end(),first.begin()+position,first.end());
+    }
+    else
+        std::set_difference(first.begin(),first.end(),second.begin(),second.end(),std::back_inserter(result));
+    return result;
+}
+template<typename Value,typename Allocator>
+size_t gallop(const std::vector<Value,Allocator> &values,size_t start,const Value &value)
+{
+    size_t low=start;
+    size_t high=start;
+    size_t step=1;
+    while(high<values.size() && values[high]<value)
+    {
+        low=high+1;
+        high=start+step;
+        step*=2;
+    }
+    high=std::min(high,values.size());
+    return std::lower_bound(values.begin()+low,values.begin()+high,value)-values.begin();
+}
@@ -0,0 +1,150 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+//what containers count when they are given CountingStatistics as their statistics policy
+enum class Counter
+{
+    split,
+    merge,
+    depthIncrease,
+    depthDecrease,
+    lookup,
+    visitedNode,//by lookups
+    insertion,//calls of insert, including ones for values which are there already
+    movedValue//by inserts: shifted inside a node and moved to a new node by splits
+};
+const size_t counterCount=size_t(Counter::movedValue)+1;
+using Counters=std::array<std::uint64_t,counterCount>;
+inline const char* getCounterName(Counter);
+inline std::uint64_t getCount(const Counters&,Counter);
+//what containers return from statistics(): leaves of one container by size relative to maxChunkSize, in tenths;
+//counters aren't kept per container, they are read with getCounters() of the statistics policy
+struct LeafFill
+{
+    static const size_t bucketCount=10;
+    std::array<size_t,bucketCount> buckets_;
+    LeafFill();
+    void addLeaf(size_t size,size_t maxChunkSize);//overfull leaves go to the last bucket
+};
+//default policy, all calls are empty and compiled away
+class NoStatistics
+{
+public:
+    static void add(Counter,std::uint64_t count=1);
+    static Counters getCounters();
+    static void reset();
+};
+//process-wide counters in thread-local atomics: a thread writes only its own ones with relaxed loads and stores,
+//so counting costs no locked instruction, and a snapshot sums all threads' counters under a lock;
+//counters of finished threads are kept; a reset concurrent with writes may lose some of them
+class CountingStatistics
+{
+public:
+    static void add(Counter,std::uint64_t count=1);
+    static Counters getCounters();
+    static void reset();
+private:
+    struct ThreadCounters
+    {
+        std::array<std::atomic<std::uint64_t>,counterCount> counters_;
+        ThreadCounters();
+        ~ThreadCounters();
+    };
+    struct Registry
+    {
+        std::mutex mutex_;
+        std::vector<ThreadCounters*> threads_;
+        Counters finished_{};//of threads which are gone
+    };
+    static Registry &getRegistry();
+    static ThreadCounters &getThreadCounters();
+};
+///////////////////////////////////////////////////////////////////////////////
+inline const char* getCounterName(Counter counter)
+{
+    switch(counter)
+    {
+    case Counter::split:return "splits";
+    case Counter::merge:return "merges";
+    case Counter::depthIncrease:return "depth increases";
+    case Counter::depthDecrease:return "depth decreases";
+    case Counter::lookup:return "lookups";
+    case Counter::visitedNode:return "visited nodes";
+    case Counter::insertion:return "insertions";
+    case Counter::movedValue:return "moved values";
+    }
+    return "unknown";
+}
+inline std::uint64_t getCount(const Counters &counters,Counter counter)
+{
+    return counters[size_t(counter)];
+}
+inline LeafFill::LeafFill()
+    :buckets_{}
+{}
+inline void LeafFill::addLeaf(size_t size,size_t maxChunkSize)
+{
+    ++buckets_[std::min(size*bucketCount/std::max<size_t>(maxChunkSize,1),bucketCount-1)];
+}
+inline void NoStatistics::add(Counter,std::uint64_t)
+{}
+inline Counters NoStatistics::getCounters()
+{
+    return Counters{};
+}
+inline void NoStatistics::reset()
+{}
+inline void CountingStatistics::add(Counter counter,std::uint64_t count)
+{
+    auto &value=getThreadCounters().counters_[size_t(counter)];
+    value.store(value.load(std::memory_order_relaxed)+count,std::memory_order_relaxed);
+}
+inline Counters CountingStatistics::getCounters()
+{
+    auto &registry=getRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex_);
+    auto counters=registry.finished_;
+    for(auto thread:registry.threads_)
+        for(size_t index=0;index<counterCount;++index)
+            counters[index]+=thread->counters_[index].load(std::memory_order_relaxed);
+    return counters;
+}
+inline void CountingStatistics::reset()
+{
+    auto &registry=getRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex_);
+    registry.finished_.fill(0);
+    for(auto thread:registry.threads_)
+        for(auto &counter:thread->counters_)
+            counter.store(0,std::memory_order_relaxed);
+}
+inline CountingStatistics::ThreadCounters::ThreadCounters()
+{
+    for(auto &counter:counters_)
+        counter.store(0,std::memory_order_relaxed);
+    auto &registry=getRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex_);
+    registry.threads_.push_back(this);
+}
+inline CountingStatistics::ThreadCounters::~ThreadCounters()
+{
+    auto &registry=getRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex_);
+    for(size_t index=0;index<counterCount;++index)
+        registry.finished_[index]+=counters_[index].load(std::memory_order_relaxed);
+    registry.threads_.erase(std::find(registry.threads_.begin(),registry.threads_.end(),this));
+}
+inline CountingStatistics::Registry &CountingStatistics::getRegistry()
+{//never destroyed: threads may finish after static objects are gone
+    static auto registry=new Registry;
+    return *registry;
+}
+inline CountingStatistics::ThreadCounters &CountingStatistics::getThreadCounters()
+{
+    thread_local ThreadCounters counters;
+    return counters;
+}
@@ -0,0 +1,379 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+//B+-tree of strings with compressed nodes: a node keeps the prefix common to its keys once,
+//the first 8 bytes of every suffix as a big-endian integer and all suffixes in one byte arena,
+//so most comparisons of a search are integer ones on a contiguous array;
+//inner nodes keep the smallest key of every child
+class StringBTree
+{
+public:
+    class Iterator;
+    StringBTree(size_t minChunkSize,size_t maxChunkSize);
+    void insert(const std::string&);
+    void erase(const std::string&);
+    bool contains(const std::string&) const;
+    void enumerate(const std::function<void(const std::string&)>&) const;
+private:
+    class KeyBlock
+    {//sorted unique strings
+    public:
+        KeyBlock();
+        size_t size() const;
+        std::string get(size_t index) const;
+        size_t findFirstNotLess(const std::string&) const;
+        bool equals(size_t index,const std::string&) const;
+        void insert(size_t index,const std::string&);
+        void erase(size_t index);
+        KeyBlock splitOff(size_t index);//returns keys starting from the index
+        void append(const KeyBlock&);
+        void enumerate(const std::function<void(const std::string&)>&) const;
+    private:
+        std::string prefix_;//common for all keys, not necessarily the longest one
+        std::vector<std::uint64_t> abbreviatedKeys_;//first bytes of suffixes, zero-padded
+        std::vector<std::uint32_t> offsets_;//suffix of a key occupies [offsets_[index],offsets_[index+1]) of arena_
+        std::string arena_;
+        std::string_view getSuffix(size_t index) const;
+        void shortenPrefix(size_t prefixSize);//moves the rest of the prefix to suffixes
+        void extendPrefix();//makes the prefix the longest common one
+        static std::uint64_t abbreviate(std::string_view);
+    };
+    struct Node
+    {
+        KeyBlock keys_;
+        std::vector<Node> children_;
+    };
+    size_t minChunkSize_,maxChunkSize_;
+    Node root_;
+    void increaseDepthIfNeeded();
+    void decreaseDepthIfNeeded();
+    static void insert(const std::string&,Node&,size_t maxChunkSize);
+    static void erase(const std::string&,Node&,size_t minChunkSize,size_t maxChunkSize);
+    static void enumerate(const Node&,const std::function<void(const std::string&)>&);
+    static void splitChild(Node&,size_t childIndex);
+    static void mergeChild(Node&,size_t childIndex);//with the next one
+};
+///////////////////////////////////////////////////////////////////////////////
+inline StringBTree::StringBTree(size_t minChunkSize,size_t maxChunkSize)
+    :minChunkSize_(minChunkSize)
+    ,maxChunkSize_(maxChunkSize)
+{}
+inline void StringBTree::insert(const std::string &value)
+{
+    insert(value,root_,maxChunkSize_);
+    increaseDepthIfNeeded();
+}
+inline void StringBTree::erase(const std::string &value)
+{
+    erase(value,root_,minChunkSize_,maxChunkSize_);
+    decreaseDepthIfNeeded();
+}
+inline bool StringBTree::contains(const std::string &value) const
+{
+    const Node *node=&root_;
+    while(true)
+    {
+        const auto index=node->keys_.findFirstNotLess(value);
+        if(index<node->keys_.size() && node->keys_.equals(index,value))
+            return true;
+        if(node->children_.empty() || index==0)
+            return false;
+        node=&node->children_[index-1];
+    }
+}
+inline void StringBTree::enumerate(const std::function<void(const std::string&)> &processor) const
+{
+    enumerate(root_,processor);
+}
+inline void StringBTree::increaseDepthIfNeeded()
+{
+    if(root_.keys_.size()<=maxChunkSize_)
+        return;
+    Node newRoot;
+    newRoot.keys_.insert(0,root_.keys_.get(0));
+    newRoot.children_.push_back(std::move(root_));
+    root_=std::move(newRoot);
+    splitChild(root_,0);
+}
+inline void StringBTree::decreaseDepthIfNeeded()
+{
+    if(root_.children_.size()!=1)
+        return;
+    auto newRoot=std::move(root_.children_.front());
+    root_=std::move(newRoot);
+}
+inline void StringBTree::insert(const std::string &value,Node &node,size_t maxChunkSize)
+{
+    const auto index=node.keys_.findFirstNotLess(value);
+    const bool isFound=(index<node.keys_.size() && node.keys_.equals(index,value));
+    if(isFound)
+        return;
+    if(node.children_.empty())
+    {
+        node.keys_.insert(index,value);
+        return;
+    }
+    const auto childIndex=(index==0?0:index-1);
+    if(index==0)
+    {//the value becomes the smallest one of the first child
+        node.keys_.erase(0);
+        node.keys_.insert(0,value);
+    }
+    auto &child=node.children_[childIndex];
+    insert(value,child,maxChunkSize);
+    if(child.keys_.size()>maxChunkSize)
+        splitChild(node,childIndex);
+}
+inline void StringBTree::erase(const std::string &value,Node &node,size_t minChunkSize,size_t maxChunkSize)
+{
+    const auto index=node.keys_.findFirstNotLess(value);
+    const bool isFound=(index<node.keys_.size() && node.keys_.equals(index,value));
+    if(node.children_.empty())
+    {
+        if(isFound)
+            node.keys_.erase(index);
+        return;
+    }
+    if(!isFound && index==0)
+        return;
+    const auto childIndex=(isFound?index:index-1);
+    auto &child=node.children_[childIndex];
+    erase(value,child,minChunkSize,maxChunkSize);
+    if(child.keys_.size()==0)
+    {
+        node.keys_.erase(childIndex);
+        node.children_.erase(node.children_.begin()+childIndex);
+        return;
+    }
+    if(isFound)
+    {//the smallest value of the child is gone
+        node.keys_.erase(childIndex);
+        node.keys_.insert(childIndex,child.keys_.get(0));
+    }
+    if(child.keys_.size()<minChunkSize && node.children_.size()>1)
+    {
+        const auto leftIndex=(childIndex>0?childIndex-1:childIndex);
+        mergeChild(node,leftIndex);
+        if(node.children_[leftIndex].keys_.size()>maxChunkSize)
+            splitChild(node,leftIndex);
+    }
+}
+inline void StringBTree::enumerate(const Node &node,const std::function<void(const std::string&)> &processor)
+{
+    if(node.children_.empty())
+        node.keys_.enumerate(processor);
+    else
+        for(const auto &child:node.children_)
+            enumerate(child,processor);
+}
+inline void StringBTree::splitChild(Node &node,size_t childIndex)
+{
+    auto &child=node.children_[childIndex];
+    const auto half=child.keys_.size()/2;
+    Node right;
+    right.keys_=child.keys_.splitOff(half);
+    if(!child.children_.empty())
+    {
+        right.children_.assign(
+            std::make_move_iterator(child.children_.begin()+half),
+            std::make_move_iterator(child.children_.end()));
+        child.children_.erase(child.children_.begin()+half,child.children_.end());
+    }
+    node.keys_.insert(childIndex+1,right.keys_.get(0));
+    node.children_.insert(node.children_.begin()+childIndex+1,std::move(right));
+}
+inline void StringBTree::mergeChild(Node &node,size_t childIndex)
+{
+    auto &left=node.children_[childIndex];
+    auto &right=node.children_[childIndex+1];
+    left.keys_.append(right.keys_);
+    left.children_.insert(
+        left.children_.end(),
+        std::make_move_iterator(right.children_.begin()),
+        std::make_move_iterator(right.children_.end()));
+    node.keys_.erase(childIndex+1);
+    node.children_.erase(node.children_.begin()+childIndex+1);
+}
+inline StringBTree::KeyBlock::KeyBlock()
+    :offsets_(1,0)
+{}
+inline size_t StringBTree::KeyBlock::size() const
+{
+    return abbreviatedKeys_.size();
+}
+inline std::string StringBTree::KeyBlock::get(size_t index) const
+{
+    auto value=prefix_;
+    value.append(getSuffix(index));
+    return value;
+}
+inline size_t StringBTree::KeyBlock::findFirstNotLess(const std::string &value) const
+{
+    const std::string_view probe(value);
+    const auto commonSize=std::min(prefix_.size(),probe.size());
+    const auto order=probe.substr(0,commonSize).compare(std::string_view(prefix_).substr(0,commonSize));
+    if(order<0 || (order==0 && probe.size()<prefix_.size()))
+        return 0;
+    if(order>0)
+        return size();
+    const auto suffix=probe.substr(prefix_.size());
+    const auto abbreviatedKey=abbreviate(suffix);
+    const auto isLess=[&](size_t index)
+    {//full suffixes are compared only when the abbreviated keys are equal
+        return abbreviatedKeys_[index]<abbreviatedKey || (abbreviatedKeys_[index]==abbreviatedKey && getSuffix(index)<suffix);
+    };
+    size_t current=size();
+    size_t step=size();
+    while(step>0)
+    {
+        if(current<step || isLess(current-step))
+            step/=2;
+        else
+            current-=step;
+    }
+    return current;
+}
+inline bool StringBTree::KeyBlock::equals(size_t index,const std::string &value) const
+{
+    return value.size()==prefix_.size()+offsets_[index+1]-offsets_[index] &&
+        value.compare(0,prefix_.size(),prefix_)==0 &&
+        std::string_view(value).substr(prefix_.size())==getSuffix(index);
+}
+inline void StringBTree::KeyBlock::insert(size_t index,const std::string &value)
+{
+    if(value.compare(0,prefix_.size(),prefix_)!=0)
+    {
+        size_t prefixSize=0;
+        while(prefixSize<value.size() && value[prefixSize]==prefix_[prefixSize])
+            ++prefixSize;
+        shortenPrefix(prefixSize);
+    }
+    const auto suffix=std::string_view(value).substr(prefix_.size());
+    const auto offset=offsets_[index];
+    arena_.insert(offset,suffix);
+    offsets_.insert(offsets_.begin()+index,offset);
+    for(auto current=index+1;current<offsets_.size();++current)
+        offsets_[current]+=std::uint32_t(suffix.size());
+    abbreviatedKeys_.insert(abbreviatedKeys_.begin()+index,abbreviate(suffix));
+}
+inline void StringBTree::KeyBlock::erase(size_t index)
+{
+    const auto suffixSize=offsets_[index+1]-offsets_[index];
+    arena_.erase(offsets_[index],suffixSize);
+    offsets_.erase(offsets_.begin()+index);
+    for(auto current=index;current<offsets_.size();++current)
+        offsets_[current]-=suffixSize;
+    abbreviatedKeys_.erase(abbreviatedKeys_.begin()+index);
+    if(size()==0)
+        prefix_.clear();
+}
+inline StringBTree::KeyBlock StringBTree::KeyBlock::splitOff(size_t index)
+{
+    KeyBlock upper;
+    upper.prefix_=prefix_;
+    const auto offset=offsets_[index];
+    upper.arena_.assign(arena_,offset,std::string::npos);
+    for(auto current=index+1;current<offsets_.size();++current)
+        upper.offsets_.push_back(offsets_[current]-offset);
+    upper.abbreviatedKeys_.assign(abbreviatedKeys_.begin()+index,abbreviatedKeys_.end());
+    arena_.resize(offset);
+    offsets_.resize(index+1);
+    abbreviatedKeys_.resize(index);
+    extendPrefix();
+    upper.extendPrefix();
+    return upper;
+}
+inline void StringBTree::KeyBlock::append(const KeyBlock &other)
+{
+    if(other.size()==0)
+        return;
+    if(size()==0)
+    {
+        *this=other;
+        return;
+    }
+    size_t prefixSize=0;
+    while(prefixSize<prefix_.size() && prefixSize<other.prefix_.size() && prefix_[prefixSize]==other.prefix_[prefixSize])
+        ++prefixSize;
+    shortenPrefix(prefixSize);
+    const auto extra=std::string_view(other.prefix_).substr(prefixSize);
+    for(size_t index=0;index<other.size();++index)
+    {
+        const auto offset=arena_.size();
+        arena_.append(extra);
+        arena_.append(other.getSuffix(index));
+        offsets_.push_back(std::uint32_t(arena_.size()));
+        abbreviatedKeys_.push_back(
+            extra.empty()?other.abbreviatedKeys_[index]:abbreviate(std::string_view(arena_).substr(offset)));
+    }
+    extendPrefix();
+}
+inline void StringBTree::KeyBlock::enumerate(const std::function<void(const std::string&)> &processor) const
+{
+    auto value=prefix_;
+    for(size_t index=0;index<size();++index)
+    {
+        value.resize(prefix_.size());
+        value.append(getSuffix(index));
+        processor(value);
+    }
+}
+inline std::string_view StringBTree::KeyBlock::getSuffix(size_t index) const
+{
+    return std::string_view(arena_).substr(offsets_[index],offsets_[index+1]-offsets_[index]);
+}
+inline void StringBTree::KeyBlock::shortenPrefix(size_t prefixSize)
+{
+    if(prefixSize>=prefix_.size())
+        return;
+    const auto extra=std::string_view(prefix_).substr(prefixSize);
+    std::string arena;
+    arena.reserve(arena_.size()+extra.size()*size());
+    for(size_t index=0;index<size();++index)
+    {
+        const auto offset=arena.size();
+        arena.append(extra);
+        arena.append(getSuffix(index));
+        offsets_[index]=std::uint32_t(offset);
+        abbreviatedKeys_[index]=abbreviate(std::string_view(arena).substr(offset));
+    }
+    offsets_.back()=std::uint32_t(arena.size());
+    arena_.swap(arena);
+    prefix_.resize(prefixSize);
+}
+inline void StringBTree::KeyBlock::extendPrefix()
+{//in sorted keys the part common for the first and the last one is common for all of them
+    if(size()==0)
+        return;
+    const auto first=getSuffix(0);
+    const auto last=getSuffix(size()-1);
+    size_t extraSize=0;
+    while(extraSize<first.size() && extraSize<last.size() && first[extraSize]==last[extraSize])
+        ++extraSize;
+    if(extraSize==0)
+        return;
+    prefix_.append(first.substr(0,extraSize));
+    std::string arena;
+    arena.reserve(arena_.size()-extraSize*size());
+    for(size_t index=0;index<size();++index)
+    {
+        const auto offset=arena.size();
+        arena.append(getSuffix(index).substr(extraSize));
+        offsets_[index]=std::uint32_t(offset);
+        abbreviatedKeys_[index]=abbreviate(std::string_view(arena).substr(offset));
+    }
+    offsets_.back()=std::uint32_t(arena.size());
+    arena_.swap(arena);
+}
+inline std::uint64_t StringBTree::KeyBlock::abbreviate(std::string_view suffix)
+{//byte order of the integer follows the order of strings, shorter suffixes are padded with zeros
+    std::uint64_t key=0;
+    for(size_t index=0;index<8;++index)
+        key=(key<<8)|(index<suffix.size()?static_cast<unsigned char>(suffix[index]):0);
+    return key;
+}
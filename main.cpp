@@ -1,15 +1,30 @@
+#include "AdaptiveSet.h"
 #include "ArraySet.h"
 #include "BTree.h"
+#include "BufferedBTree.h"
+#include "FilteredSet.h"
+#include "GappedHatSet.h"
+#include "LearnedIndexSet.h"
 #include "SortedArraySet.h"
 #include "MultilevelHat.h"
 #include "MultilevelHatWithCachedSmallest.h"
+#include "PersistentBTree.h"
+#include "ShardedSet.h"
+#include "Statistics.h"
+#include "StringBTree.h"
 #include "HatSet.h"
+#include "HugePageAllocator.h"
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <functional>
 #include <iostream>
+#include <mutex>
+#include <queue>
 #include <random>
 #include <set>
 #include <string>
+#include <thread>
 template<typename Set>
 void smokeTest(const Set &prototype)
 {
@@ -46,10 +61,490 @@ void smokeTest(const Set &prototype)
     }
 }
 template<typename Set>
+void priorityQueueSmokeTest(const Set &prototype)
+{
+    auto set=prototype;
+    bool hasThrown=false;
+    try
+    {
+        set.popMin();
+    }
+    catch(const std::logic_error&)
+    {
+        hasThrown=true;
+    }
+    if(!hasThrown)
+        throw std::logic_error("popping from an empty container didn't throw");
+    for(int c=0;c<1000;++c)
+        set.insert((c*7919)%1000);
+    for(int c=0;c<250;++c)
+    {
+        if(set.min()!=c || set.popMin()!=c)
+            throw std::logic_error("popped value is not the smallest one");
+        if(set.max()!=999-c || set.popMax()!=999-c)
+            throw std::logic_error("popped value is not the largest one");
+    }
+    set.insert(0);
+    if(set.popMin()!=0 || set.min()!=250 || set.contains(249) || !set.contains(250))
+        throw std::logic_error("a value inserted after popping is misplaced");
+    for(int c=250;c<750;++c)
+        if(set.popMin()!=c)
+            throw std::logic_error("popped value is not the smallest one");
+    if(set.contains(749))
+        throw std::logic_error("a popped value is still in the container");
+}
+void statisticsSmokeTest()
+{//counters are process-wide, so they are reset first and this tree is the only one counting afterwards
+    using Tree=BTree<int,std::allocator<int>,CountingStatistics>;
+    Tree tree(2,4);
+    CountingStatistics::reset();
+    for(int c=0;c<10;++c)
+        tree.insert(c);
+    //0 stays in the smallest leaf and 1..9 go to the largest one, which spills its lower half into the tree
+    //at 5, 7 and 9; the third spill overfills the root leaf {1..6}, which is split under a new root {4}
+    auto counters=CountingStatistics::getCounters();
+    if(getCount(counters,Counter::insertion)!=10 || getCount(counters,Counter::split)!=1
+        || getCount(counters,Counter::depthIncrease)!=1 || getCount(counters,Counter::movedValue)!=3)
+        throw std::logic_error("unexpected counters after inserts");
+    if(!tree.contains(5))//found in the leaf {5,6} below the root
+        throw std::logic_error("an inserted value is absent in the container");
+    counters=CountingStatistics::getCounters();
+    if(getCount(counters,Counter::lookup)!=1 || getCount(counters,Counter::visitedNode)!=2)
+        throw std::logic_error("unexpected counters after a lookup");
+    tree.erase(5);//{6} borrows through the separator, leaving {1,2} 3 {4,6}
+    tree.erase(1);//{2} has no sibling to borrow from, so it is merged with {4,6} and the root is left with one child
+    counters=CountingStatistics::getCounters();
+    if(getCount(counters,Counter::merge)!=1 || getCount(counters,Counter::depthDecrease)!=1
+        || getCount(counters,Counter::split)!=1)
+        throw std::logic_error("unexpected counters after erases");
+    if(!tree.contains(3) || !tree.contains(4) || tree.contains(5) || tree.contains(1))
+        throw std::logic_error("unexpected values after erases");
+}
+template<typename Set>
+void bulkEraseTest(const Set &prototype)
+{
+    auto set=prototype;
+    for(int c=0;c<1000;++c)
+        set.insert(c);
+    if(set.eraseRange(100,900)!=800 || set.eraseRange(900,100)!=0)
+        throw std::logic_error("range erasing returned a wrong number of values");
+    if(!set.contains(99) || set.contains(100) || set.contains(899) || !set.contains(900))
+        throw std::logic_error("range erasing left a wrong set of values");
+    if(set.eraseIf([](const int &value){return value%2!=0;})!=100)
+        throw std::logic_error("erasing by a predicate returned a wrong number of values");
+    for(int c=0;c<1000;++c)
+        if(set.contains(c)!=(c%2==0 && (c<100 || c>=900)))
+            throw std::logic_error("erasing by a predicate left a wrong set of values");
+    if(set.eraseRange(-1,1000)!=100)
+        throw std::logic_error("erasing everything returned a wrong number of values");
+    set.insert(5);
+    if(!set.contains(5))
+        throw std::logic_error("a value inserted after range erasing is absent");
+}
+template<typename Set>
+void compactionSmokeTest(const Set &prototype)
+{
+    auto set=prototype;
+    for(int c=0;c<1000;++c)
+        set.insert(c);
+    for(int c=0;c<1000;++c)
+        if(c%10!=0)
+            set.erase(c);
+    for(const size_t budget:{7,0})
+    {//a zero budget still makes progress
+        size_t stepCount=0;
+        while(set.compactStep(budget))
+            if(++stepCount>1000)
+                throw std::logic_error("incremental compaction doesn't finish");
+        for(int c=0;c<1000;c+=3)
+            set.insert(c);
+    }
+    set.shrinkToFit();
+    set.compact();
+    for(int c=0;c<1000;++c)
+        if(set.contains(c)!=(c%10==0 || c%3==0))
+            throw std::logic_error("compaction changed the content");
+}
+template<typename Set>
+void setAlgebraTest(const Set &prototype)
+{
+    auto multiplesOf2=prototype,multiplesOf3=prototype;
+    for(int c=0;c<1000;++c)
+    {
+        multiplesOf2.insert(c*2);
+        multiplesOf3.insert(c*3);
+    }
+    const auto united=Set::setUnion(multiplesOf2,multiplesOf3);
+    const auto intersected=Set::setIntersection(multiplesOf2,multiplesOf3);
+    const auto subtracted=Set::setDifference(multiplesOf2,multiplesOf3);
+    for(int c=0;c<3000;++c)
+    {
+        const bool in2=(c%2==0 && c<2000),in3=(c%3==0);
+        if(united.contains(c)!=(in2 || in3))
+            throw std::logic_error("wrong union of two sets");
+        if(intersected.contains(c)!=(in2 && in3))
+            throw std::logic_error("wrong intersection of two sets");
+        if(subtracted.contains(c)!=(in2 && !in3))
+            throw std::logic_error("wrong difference of two sets");
+    }
+    multiplesOf2.merge(multiplesOf3);
+    for(int c=0;c<3000;++c)
+        if(multiplesOf2.contains(c)!=united.contains(c))
+            throw std::logic_error("merging gives not the same as the union");
+    auto small=prototype,large=prototype;//a few values spread over a large set, some of them out of its range
+    for(int c=0;c<100000;++c)
+        large.insert(c*2);
+    for(const auto value:{-5,0,1,777,778,50000,99999,100000,199998,199999,250000})
+        small.insert(value);
+    const auto smallAndLarge=Set::setIntersection(small,large),largeAndSmall=Set::setIntersection(large,small);
+    const auto smallWithoutLarge=Set::setDifference(small,large);
+    for(const auto value:{-5,0,1,777,778,50000,99999,100000,199998,199999,250000})
+    {
+        const bool inLarge=(value%2==0 && value>=0 && value<200000);
+        if(smallAndLarge.contains(value)!=inLarge || largeAndSmall.contains(value)!=inLarge)
+            throw std::logic_error("wrong intersection of a small set and a large one");
+        if(smallWithoutLarge.contains(value)==inLarge)
+            throw std::logic_error("wrong difference of a small set and a large one");
+    }
+    const auto subtractedFromLarge=Set::setDifference(large,small);
+    for(int c=-10;c<200010;++c)
+        if(subtractedFromLarge.contains(c)!=(c%2==0 && c>=0 && c<200000 && c!=0 && c!=778 && c!=50000 && c!=100000 && c!=199998))
+            throw std::logic_error("wrong difference of a large set and a small one");
+}
+template<typename Set>
+void deferredRebalancingTest(const Set &prototype)
+{//most operations are erases, so inner nodes lose their children one by one down to a last leaf, which gets empty too
+    std::default_random_engine engine;
+    std::uniform_int_distribution<int> random(0,9999);
+    auto set=prototype;
+    std::set<int> expected;
+    for(int c=0;c<10000;++c)
+    {
+        set.insert(c);
+        expected.insert(c);
+    }
+    for(int c=0;c<200000;++c)
+    {
+        const auto value=random(engine);
+        if(c%10==0)
+        {
+            set.insert(value);
+            expected.insert(value);
+        }
+        else
+        {
+            set.erase(value);
+            expected.erase(value);
+        }
+        if(set.contains(value)!=(expected.count(value)!=0))
+            throw std::logic_error("a container with deferred rebalancing gives a wrong result");
+    }
+    for(int c=0;c<10000;++c)
+        if(set.contains(c)!=(expected.count(c)!=0))
+            throw std::logic_error("a container with deferred rebalancing has wrong content");
+}
+template<typename Set>
+void splitJoinTest(const Set &prototype)
+{
+    const auto check=[](const Set &set,const std::set<int> &expected,const std::string &message)
+    {
+        std::vector<int> values;
+        set.enumerate([&](int value){values.push_back(value);});
+        if(values!=std::vector<int>(expected.begin(),expected.end()))
+            throw std::logic_error(message);
+    };
+    auto set=prototype;
+    std::set<int> reference;
+    for(int c=0;c<1000;c+=2)
+    {
+        set.insert(c);
+        reference.insert(c);
+    }
+    for(const auto key:{-100,0,1,600,601,998,999,5000})
+    {//below the minimum, existing keys and missing ones, the maximum and above it
+        auto [left,right]=Set::split(Set(set),key);
+        check(left,std::set<int>(reference.begin(),reference.lower_bound(key)),"wrong left part after splitting");
+        check(right,std::set<int>(reference.lower_bound(key),reference.end()),"wrong right part after splitting");
+        auto joined=Set::join(std::move(left),std::move(right));
+        check(joined,reference,"a value is lost after splitting and joining");
+    }
+    for(const auto leftCount:{0,1,10,1000,20000})
+        for(const auto rightCount:{0,1,10,1000,20000})
+        {//trees of different heights, either of them can be empty
+            auto left=prototype,right=prototype;
+            std::set<int> expected;
+            for(int c=0;c<leftCount;++c)
+            {
+                left.insert(c);
+                expected.insert(c);
+            }
+            for(int c=0;c<rightCount;++c)
+            {
+                right.insert(100000+c);
+                expected.insert(100000+c);
+            }
+            auto joined=Set::join(std::move(left),std::move(right));
+            check(joined,expected,"wrong content after joining trees of different heights");
+            for(int c=0;c<300;++c)
+            {
+                joined.insert(50000+c);
+                expected.insert(50000+c);
+                joined.erase(c*3);
+                expected.erase(c*3);
+                joined.erase(100000+c*7);
+                expected.erase(100000+c*7);
+            }
+            check(joined,expected,"wrong content after writing to a joined tree");
+        }
+    for(const auto rightMin:{3,5})
+    {//the smallest value of the right tree is below the largest one of the left tree or equal to it
+        auto left=prototype,right=prototype;
+        left.insert(1);
+        left.insert(5);
+        right.insert(rightMin);
+        right.insert(10);
+        bool hasThrown=false;
+        try
+        {
+            Set::join(std::move(left),std::move(right));
+        }
+        catch(const std::logic_error&)
+        {
+            hasThrown=true;
+        }
+        if(!hasThrown)
+            throw std::logic_error("overlapping trees have been joined");
+    }
+}
+void adaptiveChunkSizeTest()
+{//with short epochs the chunk size moves under writes, the content is kept and concurrent reads see all of it
+    AdaptiveSet<int,BTree<int>> set(4,256,1024);
+    std::set<int> reference;
+    const auto initialMaxChunkSize=set.getMaxChunkSize();
+    bool hasChanged=false;
+    std::default_random_engine engine;
+    std::uniform_int_distribution<int> random(0,9999);
+    for(int c=0;c<100000;++c)
+    {
+        const auto value=random(engine);
+        if(c%3==0)
+        {
+            set.erase(value);
+            reference.erase(value);
+        }
+        else
+        {
+            set.insert(value);
+            reference.insert(value);
+        }
+        if(c%7==0 && set.contains(value)!=(reference.count(value)!=0))
+            throw std::logic_error("adaptive set lost a value while tuning its chunk size");
+        hasChanged|=(set.getMaxChunkSize()!=initialMaxChunkSize);
+    }
+    if(!hasChanged)
+        throw std::logic_error("adaptive set didn't change its chunk size");
+    std::vector<int> values;
+    set.enumerate([&](int value){values.push_back(value);});
+    if(values!=std::vector<int>(reference.begin(),reference.end()))
+        throw std::logic_error("adaptive set has changed its content while tuning its chunk size");
+    std::atomic<int> mismatchCount{0};
+    std::vector<std::thread> readers;
+    for(int threadIndex=0;threadIndex<4;++threadIndex)
+        readers.emplace_back([&]
+        {
+            for(int c=0;c<10000;++c)
+                if(set.contains(c)!=(reference.count(c)!=0))
+                    ++mismatchCount;
+        });
+    for(auto &thread:readers)
+        thread.join();
+    if(mismatchCount>0)
+        throw std::logic_error("concurrent reads of an adaptive set gave wrong results");
+}
+template<typename Inner>
+void shardingTest(const Inner &prototype)
+{//enumeration stays ordered and complete after forced rebalancing and after boundaries moved by monotonic inserts
+    using Set=ShardedSet<int,Inner>;
+    for(const auto partitioning:{Set::Partitioning::hash,Set::Partitioning::range})
+    {
+        Set set(prototype,4,partitioning);
+        std::set<int> reference;
+        const auto check=[&]
+        {
+            std::vector<int> values;
+            set.enumerate([&](int value){values.push_back(value);});
+            if(values!=std::vector<int>(reference.begin(),reference.end()))
+                throw std::logic_error("sharded enumeration differs from the reference");
+            for(const auto &[from,to]:{std::pair{-1,0},std::pair{0,1},std::pair{5000,5001},std::pair{1234,98765},
+                std::pair{-100,200000},std::pair{150000,400000},std::pair{7,7}})
+            {
+                values.clear();
+                set.enumerateRange(from,to,[&](int value){values.push_back(value);});
+                if(values!=std::vector<int>(reference.lower_bound(from),reference.lower_bound(std::max(from,to))))
+                    throw std::logic_error("sharded range enumeration differs from the reference");
+            }
+        };
+        std::default_random_engine engine;
+        std::uniform_int_distribution<int> random(0,99999);
+        for(int c=0;c<20000;++c)
+        {
+            const auto value=random(engine);
+            if(c%4==0)
+            {
+                set.erase(value);
+                reference.erase(value);
+            }
+            else
+            {
+                set.insert(value);
+                reference.insert(value);
+            }
+        }
+        check();
+        set.rebalance();
+        check();
+        for(int c=100000;c<400000;++c)
+        {//the last shard gets all of these
+            set.insert(c);
+            reference.insert(c);
+        }
+        check();
+        set.rebalance();
+        check();
+    }
+}
+void snapshotTest()
+{
+    PersistentBTree<int> set(10,19);
+    for(int c=0;c<1000;c+=2)
+        set.insert(c);
+    const auto snapshot=set.snapshot();
+    for(int c=0;c<1000;++c)
+    {
+        if(c%2==0)
+            set.erase(c);
+        else
+            set.insert(c);
+    }
+    for(int c=0;c<1000;++c)
+    {
+        if(snapshot.contains(c)!=(c%2==0))
+            throw std::logic_error("a snapshot has been changed by writing to the original container");
+        if(set.contains(c)!=(c%2!=0))
+            throw std::logic_error("writing to a container with a snapshot taken gave a wrong result");
+    }
+}
+void concurrentSnapshotTest()
+{//one thread writes and publishes snapshots, the others read the latest one published, each sees exactly what was there
+    struct Published
+    {
+        PersistentBTree<int> snapshot;
+        size_t count;
+        long long sum;
+    };
+    PersistentBTree<int> set(4,7);
+    std::mutex mutex;
+    std::shared_ptr<const Published> published;
+    std::atomic<bool> isWritten{false};
+    std::atomic<int> checkCount{0};
+    std::atomic<bool> isBroken{false};
+    std::vector<std::thread> readers;
+    for(int threadIndex=0;threadIndex<3;++threadIndex)
+        readers.emplace_back([&]
+        {
+            while(!isWritten && !isBroken)
+            {
+                std::shared_ptr<const Published> current;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    current=published;
+                }
+                if(!current)
+                    continue;
+                size_t count=0;
+                long long sum=0;
+                int previous=-1;
+                current->snapshot.enumerate([&](int value)
+                {
+                    if(value<=previous)
+                        isBroken=true;
+                    previous=value;
+                    ++count;
+                    sum+=value;
+                });
+                if(count!=current->count || sum!=current->sum)
+                    isBroken=true;
+                ++checkCount;
+            }
+        });
+    std::default_random_engine engine;
+    std::uniform_int_distribution<int> random(0,9999);
+    std::set<int> reference;
+    for(int c=0;!isBroken && (c<200000 || checkCount<100);++c)
+    {
+        const auto value=random(engine);
+        if(c%3==0)
+        {
+            set.erase(value);
+            reference.erase(value);
+        }
+        else
+        {
+            set.insert(value);
+            reference.insert(value);
+        }
+        if(c%100==0)
+        {
+            long long sum=0;
+            for(const auto value:reference)
+                sum+=value;
+            auto next=std::make_shared<const Published>(Published{set.snapshot(),reference.size(),sum});
+            std::lock_guard<std::mutex> lock(mutex);
+            published=std::move(next);
+        }
+    }
+    isWritten=true;
+    for(auto &thread:readers)
+        thread.join();
+    if(isBroken)
+        throw std::logic_error("a snapshot has been changed while being read from another thread");
+}
+template<typename Set>
 bool contains(const Set &set,int value)
 {
     return set.contains(value);
 }
+template<typename Set>
+void stringSmokeTest(const Set &prototype)
+{//keys share long prefixes, some are prefixes of others, some have bytes which are negative as signed chars
+    std::default_random_engine engine;
+    std::uniform_int_distribution<int> random(0,999);
+    const std::vector<std::string> prefixes{"","a","https://example.com/","https://example.com/catalog/","\xff"};
+    auto set=prototype;
+    std::set<std::string> reference;
+    for(int c=0;c<20000;++c)
+    {
+        auto value=prefixes[random(engine)%prefixes.size()];
+        if(random(engine)%4!=0)
+            value+=std::to_string(random(engine));
+        if(random(engine)%3==0)
+        {
+            set.erase(value);
+            reference.erase(value);
+        }
+        else
+        {
+            set.insert(value);
+            reference.insert(value);
+        }
+        if(set.contains(value)!=(reference.count(value)!=0))
+            throw std::logic_error("a string container disagrees with std::set on '"+value+"'");
+    }
+    std::vector<std::string> values;
+    set.enumerate([&](const std::string &value){values.push_back(value);});
+    if(values!=std::vector<std::string>(reference.begin(),reference.end()))
+        throw std::logic_error("a string container enumerates values out of order");
+}
 bool contains(const std::set<int> &set,int value)
 {
     return set.count(value)!=0;
@@ -101,6 +596,388 @@ void performanceTest(const Set &prototype,const std::string &title)
         std::cout<<std::endl;
     }
 }
+template<typename Set>
+void concurrentPerformanceTest(const Set &prototype,const std::string &title)
+{
+    const int count=4000000;
+    std::cout<<"----"<<std::endl;
+    std::cout<<title<<std::endl;
+    std::cout<<"\t"<<"inserting(us)"<<"\t"<<"searching(us)"<<std::endl;
+    for(unsigned threadCount=1;threadCount<=std::max(1u,std::thread::hardware_concurrency());threadCount*=2)
+    {
+        auto set=prototype;
+        std::atomic<int> sum{0};//just to avoid optimizations
+        const auto runInThreads=[&](const std::function<void(int value)> &operation)
+        {
+            const auto start=std::chrono::steady_clock::now();
+            std::vector<std::thread> threads;
+            for(unsigned threadIndex=0;threadIndex<threadCount;++threadIndex)
+                threads.emplace_back([&,threadIndex]
+                {
+                    std::default_random_engine engine(threadIndex);
+                    std::uniform_int_distribution<int> random;
+                    for(int c=0;c<count/static_cast<int>(threadCount);++c)
+                        operation(random(engine));
+                });
+            for(auto &thread:threads)
+                thread.join();
+            const auto finish=std::chrono::steady_clock::now();
+            const double seconds=
+                std::chrono::duration_cast<std::chrono::milliseconds>(finish-start).count()/1000.;
+            std::cout<<"\t"<<seconds/count*1000000;
+        };
+        std::cout<<threadCount;
+        runInThreads([&](int value){set.insert(value/2*2);});
+        runInThreads([&](int value){sum+=set.contains(value);});
+        std::cout<<"\t"<<sum;
+        std::cout<<std::endl;
+    }
+}
+template<typename Set>
+void calibrationTest(const std::string &title,double readShare)
+{//sweeps chunk sizes for a mixed workload on this machine
+    const int count=1000000;
+    std::cout<<"----"<<std::endl;
+    std::cout<<"calibrating "<<title<<" for "<<readShare*100<<"% of reads"<<std::endl;
+    std::cout<<"\t"<<"operation(us)"<<std::endl;
+    size_t bestMaxChunkSize=0;
+    double bestSeconds=0;
+    for(size_t maxChunkSize=16;maxChunkSize<=65536;maxChunkSize*=2)
+    {
+        std::default_random_engine engine;
+        std::uniform_int_distribution<int> random;
+        std::bernoulli_distribution isReading(readShare);
+        std::cout<<maxChunkSize;
+        std::vector<int> values;
+        for(int c=0;c<count;++c)
+            values.push_back(random(engine)/2*2);
+        Set set(maxChunkSize/2,maxChunkSize);
+        for(auto value:values)
+            set.insert(value);
+        int sum=0;//just to avoid optimizations
+        const auto start=std::chrono::steady_clock::now();
+        for(int c=0;c<count;++c)
+        {
+            if(isReading(engine))
+                sum+=set.contains(random(engine));
+            else if(c%2==0)
+                set.insert(random(engine)/2*2);
+            else
+                set.erase(values[c]);
+        }
+        const auto finish=std::chrono::steady_clock::now();
+        const double seconds=
+            std::chrono::duration_cast<std::chrono::milliseconds>(finish-start).count()/1000.;
+        std::cout<<"\t"<<seconds/count*1000000;
+        std::cout<<"\t"<<sum;
+        std::cout<<std::endl;
+        if(bestMaxChunkSize==0 || seconds<bestSeconds)
+        {
+            bestMaxChunkSize=maxChunkSize;
+            bestSeconds=seconds;
+        }
+    }
+    std::cout<<"best: ("<<bestMaxChunkSize/2<<","<<bestMaxChunkSize<<")"<<std::endl;
+}
+class CountingInt
+{//counts copies made by containers, i.e. how many values they move around
+public:
+    static size_t copyCount;
+    CountingInt(int value=0);
+    CountingInt(const CountingInt&);
+    CountingInt &operator=(const CountingInt&);
+    bool operator<(const CountingInt &other) const {return value_<other.value_;}
+    bool operator==(const CountingInt &other) const {return value_==other.value_;}
+    bool operator!=(const CountingInt &other) const {return value_!=other.value_;}
+private:
+    int value_;
+};
+size_t CountingInt::copyCount=0;
+CountingInt::CountingInt(int value)
+    :value_(value)
+{}
+CountingInt::CountingInt(const CountingInt &other)
+    :value_(other.value_)
+{
+    ++copyCount;
+}
+CountingInt &CountingInt::operator=(const CountingInt &other)
+{
+    value_=other.value_;
+    ++copyCount;
+    return *this;
+}
+template<typename Set>
+void stringPerformanceTest(const Set &prototype,const std::string &title)
+{//URL-like keys, most bytes of a comparison are spent on the shared part
+    std::cout<<"----"<<std::endl;
+    std::cout<<title<<std::endl;
+    std::cout<<"\t"<<"inserting(us)"<<"\t"<<"searching(us)"<<"\t"<<"erasing(us)"<<std::endl;
+    for(int count=1000;count<=1000000;count*=4)
+    {
+        std::default_random_engine engine;
+        std::uniform_int_distribution<int> random;
+        std::cout<<count;
+        std::vector<std::string> values;
+        for(int c=0;c<count;++c)
+        {
+            const auto number=random(engine);
+            values.push_back(
+                "https://www.example.com/catalog/products/category-"+std::to_string(number%64)+"/item-"+std::to_string(number));
+        }
+        auto set=prototype;
+        int sum=0;//just to avoid optimizations
+        const auto measure=[&](const std::function<void(const std::string&)> &operation)
+        {
+            const auto start=std::chrono::steady_clock::now();
+            for(const auto &value:values)
+                operation(value);
+            const auto finish=std::chrono::steady_clock::now();
+            const double seconds=
+                std::chrono::duration_cast<std::chrono::milliseconds>(finish-start).count()/1000.;
+            std::cout<<"\t"<<seconds/count*1000000;
+        };
+        measure([&](const std::string &value){set.insert(value);});
+        measure([&](const std::string &value){sum+=set.contains(value);});
+        measure([&](const std::string &value){set.erase(value);});
+        std::cout<<"\t"<<sum;
+        std::cout<<std::endl;
+    }
+}
+template<typename Set>
+void churnTest(const Set &prototype,const std::string &title)
+{//values inserted in order leave nodes at the lower limit, erasing and inserting them back hits it every time
+    const int count=1000000;
+    const int operationCount=1000000;
+    auto set=prototype;
+    for(int c=0;c<count;++c)
+        set.insert(c);
+    std::default_random_engine engine;
+    std::uniform_int_distribution<int> random(0,count-1);
+    CountingInt::copyCount=0;
+    const auto start=std::chrono::steady_clock::now();
+    for(int c=0;c<operationCount/2;++c)
+    {
+        const auto value=random(engine);
+        set.erase(value);
+        set.insert(value);
+    }
+    const auto finish=std::chrono::steady_clock::now();
+    const double seconds=std::chrono::duration_cast<std::chrono::milliseconds>(finish-start).count()/1000.;
+    std::cout<<title<<"\t"<<double(CountingInt::copyCount)/operationCount<<"\t"<<seconds/operationCount*1000000<<std::endl;
+}
+template<typename Set>
+void latencyTest(const Set &prototype,const std::string &title)
+{//the tail is what an occasional split costs, the mean hides it
+    const int count=1000000;
+    std::default_random_engine engine;
+    std::uniform_int_distribution<int> random;
+    auto set=prototype;
+    std::vector<double> latencies;
+    latencies.reserve(count);
+    for(int c=0;c<count;++c)
+    {
+        const auto value=random(engine);
+        const auto start=std::chrono::steady_clock::now();
+        set.insert(value);
+        const auto finish=std::chrono::steady_clock::now();
+        latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(finish-start).count()/1000.);
+    }
+    std::sort(latencies.begin(),latencies.end());
+    const auto percentile=[&](double share){return latencies[size_t(share*(latencies.size()-1))];};
+    std::cout<<title;
+    for(auto share:{0.5,0.99,0.999,0.9999,1.})
+        std::cout<<"\t"<<percentile(share);
+    std::cout<<std::endl;
+}
+template<typename Set>
+void statisticsTest(const Set &prototype,const std::string &title)
+{//what the container did for random inserts and lookups, and how full its leaves were left
+    const int count=1000000;
+    std::default_random_engine engine;
+    std::uniform_int_distribution<int> random;
+    auto set=prototype;
+    CountingStatistics::reset();
+    for(int c=0;c<count;++c)
+        set.insert(random(engine));
+    int sum=0;//just to avoid optimizations
+    engine.seed();//inserted values are looked up
+    for(int c=0;c<count;++c)
+        sum+=set.contains(random(engine));
+    const auto counters=CountingStatistics::getCounters();
+    const auto leafFill=set.statistics();
+    std::cout<<title;
+    for(auto counter:{Counter::split,Counter::merge,Counter::depthIncrease,Counter::depthDecrease})
+        std::cout<<"\t"<<getCount(counters,counter);
+    std::cout<<"\t"<<double(getCount(counters,Counter::visitedNode))/getCount(counters,Counter::lookup);
+    std::cout<<"\t"<<double(getCount(counters,Counter::movedValue))/getCount(counters,Counter::insertion);
+    std::cout<<"\t";
+    for(size_t bucket=0;bucket<leafFill.buckets_.size();++bucket)
+        std::cout<<(bucket>0?"/":"")<<leafFill.buckets_[bucket];
+    std::cout<<"\t"<<sum<<std::endl;
+}
+template<typename Set>
+void eraseRange(Set &set,int from,int to)
+{
+    set.eraseRange(from,to);
+}
+void eraseRange(std::set<int> &set,int from,int to)
+{
+    set.erase(set.lower_bound(from),set.lower_bound(to));
+}
+template<typename Set>
+void expirationTest(const Set &prototype,const std::string &title,bool isRangeErased)
+{//values are timestamps: each round adds a batch of newer ones and expires everything below a watermark
+    const int liveCount=1000000;
+    const int batchSize=10000;
+    const int roundCount=300;
+    std::default_random_engine engine;
+    std::vector<int> batch(batchSize);
+    auto set=prototype;
+    int watermark=0;
+    double seconds=0;
+    for(int round=0;round<roundCount;++round)
+    {
+        for(int c=0;c<batchSize;++c)
+            batch[c]=round*batchSize+c;
+        std::shuffle(batch.begin(),batch.end(),engine);
+        for(auto value:batch)
+            set.insert(value);
+        const auto newWatermark=std::max((round+1)*batchSize-liveCount,0);
+        const auto start=std::chrono::steady_clock::now();
+        if(isRangeErased)
+            eraseRange(set,watermark,newWatermark);
+        else
+            for(auto value=watermark;value<newWatermark;++value)
+                set.erase(value);
+        const auto finish=std::chrono::steady_clock::now();
+        seconds+=std::chrono::duration_cast<std::chrono::microseconds>(finish-start).count()/1000000.;
+        watermark=newWatermark;
+    }
+    std::cout<<title<<"\t"<<seconds/watermark*1000000<<std::endl;
+}
+template<typename Set>
+void compactionTest(const Set &prototype,const std::string &title)
+{//most values are erased, so lookups pass many small nodes until the rest is repacked
+    const int count=2000000;
+    std::default_random_engine engine;
+    std::uniform_int_distribution<int> random;
+    std::vector<int> values;
+    for(int c=0;c<count;++c)
+        values.push_back(random(engine));
+    auto set=prototype;
+    for(auto value:values)
+        set.insert(value);
+    for(int c=0;c<count;++c)
+        if(c%20!=0)
+            set.erase(values[c]);
+    int sum=0;//just to avoid optimizations
+    const auto measureSearching=[&]
+    {
+        const auto start=std::chrono::steady_clock::now();
+        for(auto value:values)
+            sum+=set.contains(value);
+        const auto finish=std::chrono::steady_clock::now();
+        std::cout<<"\t"<<std::chrono::duration_cast<std::chrono::microseconds>(finish-start).count()/double(count);
+    };
+    std::cout<<title;
+    measureSearching();
+    const auto start=std::chrono::steady_clock::now();
+    set.compact();
+    const auto finish=std::chrono::steady_clock::now();
+    std::cout<<"\t"<<std::chrono::duration_cast<std::chrono::microseconds>(finish-start).count()/1000.;
+    measureSearching();
+    std::cout<<"\t"<<sum<<std::endl;
+}
+template<typename Set>
+void incrementalCompactionTest(const Set &prototype,const std::string &title,size_t budget)
+{//the same repacking in slices between requests, the longest slice is what a request may wait for
+    const int count=2000000;
+    std::default_random_engine engine;
+    std::uniform_int_distribution<int> random;
+    auto set=prototype;
+    for(int c=0;c<count;++c)
+        set.insert(random(engine));
+    engine.seed();
+    for(int c=0;c<count;++c)
+    {
+        const auto value=random(engine);
+        if(c%20!=0)
+            set.erase(value);
+    }
+    size_t stepCount=0;
+    double longestStep=0;
+    bool isCompacting=true;
+    while(isCompacting)
+    {
+        const auto start=std::chrono::steady_clock::now();
+        isCompacting=set.compactStep(budget);
+        const auto finish=std::chrono::steady_clock::now();
+        longestStep=std::max(longestStep,std::chrono::duration_cast<std::chrono::nanoseconds>(finish-start).count()/1000.);
+        ++stepCount;
+    }
+    std::cout<<title<<"\t"<<stepCount<<"\t"<<longestStep<<std::endl;
+}
+using MinQueue=std::priority_queue<int,std::vector<int>,std::greater<int>>;
+template<typename Set>
+void push(Set &set,int value)
+{
+    set.insert(value);
+}
+void push(MinQueue &queue,int value)
+{
+    queue.push(value);
+}
+template<typename Set>
+int popMin(Set &set)
+{
+    return set.popMin();
+}
+int popMin(std::set<int> &set)
+{
+    const auto value=*set.begin();
+    set.erase(set.begin());
+    return value;
+}
+int popMin(MinQueue &queue)
+{
+    const auto value=queue.top();
+    queue.pop();
+    return value;
+}
+template<typename Set>
+void priorityQueueTest(const Set &prototype,const std::string &title)
+{//the queue is filled, then each popped value is replaced by a later one (as events of a simulation are), then drained;
+ //a replacement keeps the remainder modulo count, so values stay unique and sets hold as many of them as the heap
+    const int count=1000000;
+    std::default_random_engine engine;
+    std::uniform_int_distribution<int> random(1,8);
+    std::vector<int> values;
+    for(int c=0;c<count;++c)
+        values.push_back(c);
+    std::shuffle(values.begin(),values.end(),engine);
+    auto set=prototype;
+    int sum=0;//just to avoid optimizations
+    std::cout<<title;
+    const auto measure=[&](const std::function<void(int)> &operation)
+    {
+        const auto start=std::chrono::steady_clock::now();
+        for(int c=0;c<count;++c)
+            operation(c);
+        const auto finish=std::chrono::steady_clock::now();
+        const double seconds=std::chrono::duration_cast<std::chrono::milliseconds>(finish-start).count()/1000.;
+        std::cout<<"\t"<<seconds/count*1000000;
+    };
+    measure([&](int c){push(set,values[c]);});
+    measure([&](int)
+    {
+        const auto value=popMin(set);
+        sum+=value;
+        push(set,value+count*random(engine));
+    });
+    measure([&](int){sum+=popMin(set);});
+    std::cout<<"\t"<<sum<<std::endl;
+}
 int main()
 {
     try
@@ -108,16 +985,160 @@ int main()
         smokeTest(ArraySet<int>());
         smokeTest(SortedArraySet<int>());
         smokeTest(HatSet<int>(10,19));
+        smokeTest(HatSet<int>(10,19,3));
+        smokeTest(GappedHatSet<int>(10,19));
         smokeTest(MultilevelHat<int>(10,19));
         smokeTest(MultilevelHatWithCachedSmallest<int>(10,19));
         smokeTest(BTree<int>(10,19));
+        smokeTest(BTree<int>(10,19,5));
+        smokeTest(BTree<int>(10,19,BTree<int>::deferredRebalancing));
+        smokeTest(MultilevelHat<int>(10,19,5));
+        smokeTest(MultilevelHatWithCachedSmallest<int>(10,19,MultilevelHatWithCachedSmallest<int>::deferredRebalancing));
+        smokeTest(BufferedBTree<int>(10,19,4,8));
+        smokeTest(BTree<int,HugePageAllocator<int>>(10,19));
+        smokeTest(MultilevelHatWithCachedSmallest<int,HugePageAllocator<int,NumaPlacement::interleaved>>(10,19));
+        smokeTest(SortedArraySet<int,HugePageAllocator<int,NumaPlacement::local>>());
+        smokeTest(AdaptiveSet<int,BTree<int>>(4,64));
+        adaptiveChunkSizeTest();
+        deferredRebalancingTest(BTree<int>(10,19,BTree<int>::deferredRebalancing));
+        deferredRebalancingTest(MultilevelHat<int>(10,19,MultilevelHat<int>::deferredRebalancing));
+        deferredRebalancingTest(MultilevelHatWithCachedSmallest<int>(10,19,MultilevelHatWithCachedSmallest<int>::deferredRebalancing));
+        smokeTest(LearnedIndexSet<int>());
+        smokeTest(LearnedIndexSet<int>(0,2));
+        smokeTest(FilteredSet<int,BTree<int>>(BTree<int>(10,19)));
+        smokeTest(FilteredSet<int,MultilevelHat<int>>(MultilevelHat<int>(10,19),4));
+        priorityQueueSmokeTest(BTree<int>(10,19));
+        priorityQueueSmokeTest(BTree<int>(10,19,5));
+        priorityQueueSmokeTest(HatSet<int>(10,19));
+        priorityQueueSmokeTest(HatSet<int>(10,19,3));
+        priorityQueueSmokeTest(MultilevelHat<int>(10,19));
+        priorityQueueSmokeTest(MultilevelHatWithCachedSmallest<int>(10,19));
+        smokeTest(BTree<int,std::allocator<int>,CountingStatistics>(10,19));
+        smokeTest(HatSet<int,std::allocator<int>,CountingStatistics>(10,19,3));
+        smokeTest(MultilevelHat<int,std::allocator<int>,CountingStatistics>(10,19));
+        smokeTest(MultilevelHatWithCachedSmallest<int,std::allocator<int>,CountingStatistics>(10,19));
+        statisticsSmokeTest();
+        bulkEraseTest(BTree<int>(10,19));
+        bulkEraseTest(BTree<int>(10,19,5));
+        bulkEraseTest(HatSet<int>(10,19));
+        bulkEraseTest(HatSet<int>(10,19,3));
+        bulkEraseTest(MultilevelHatWithCachedSmallest<int>(10,19));
+        compactionSmokeTest(HatSet<int>(10,19));
+        compactionSmokeTest(HatSet<int>(10,19,3));
+        compactionSmokeTest(HatSet<int>(0,19));
+        setAlgebraTest(SortedArraySet<int>());
+        setAlgebraTest(BTree<int>(10,19));
+        splitJoinTest(BTree<int>(10,19));
+        splitJoinTest(MultilevelHatWithCachedSmallest<int>(10,19));
+        smokeTest(PersistentBTree<int>(10,19));
+        snapshotTest();
+        concurrentSnapshotTest();
+        bulkEraseTest(PersistentBTree<int>(10,19));
+        setAlgebraTest(PersistentBTree<int>(10,19));
+        splitJoinTest(PersistentBTree<int>(10,19));
+        priorityQueueSmokeTest(PersistentBTree<int>(10,19));
+        stringSmokeTest(BTree<std::string>(10,19));
+        stringSmokeTest(StringBTree(10,19));
+        stringSmokeTest(StringBTree(2,3));
+        smokeTest(ShardedSet<int,BTree<int>>(BTree<int>(10,19),4,ShardedSet<int,BTree<int>>::Partitioning::hash));
+        smokeTest(ShardedSet<int,BTree<int>>(BTree<int>(10,19),4,ShardedSet<int,BTree<int>>::Partitioning::range));
+        shardingTest(BTree<int>(10,19));
+        shardingTest(MultilevelHatWithCachedSmallest<int>(10,19));
         performanceTest(ArraySet<int>(),"array");
         performanceTest(SortedArraySet<int>(),"sorted array");
+        performanceTest(SortedArraySet<int,HugePageAllocator<int>>(),"sorted array on huge pages");
         performanceTest(HatSet<int>(10000,19999),"HAT");
+        performanceTest(GappedHatSet<int>(10000,19999),"HAT with gapped chunks");
         performanceTest(MultilevelHat<int>(1000,1999),"multilevel HAT");
         performanceTest(MultilevelHatWithCachedSmallest<int>(1000,1999),"multilevel HAT with cached smallest element");
+        performanceTest(
+            MultilevelHatWithCachedSmallest<int,HugePageAllocator<int>>(1000,1999),
+            "multilevel HAT with cached smallest element on huge pages");
         performanceTest(BTree<int>(1000,1999),"B-tree");
+        performanceTest(BTree<int,HugePageAllocator<int>>(1000,1999),"B-tree on huge pages");
+        performanceTest(
+            BTree<int,HugePageAllocator<int,NumaPlacement::interleaved>>(1000,1999),
+            "B-tree on huge pages interleaved over NUMA nodes");
+        performanceTest(BufferedBTree<int>(500,999,8,4096),"buffered B-tree");
+        performanceTest(FilteredSet<int,BTree<int>>(BTree<int>(1000,1999)),"B-tree with Bloom filter");
+        performanceTest(FilteredSet<int,MultilevelHat<int>>(MultilevelHat<int>(1000,1999)),"multilevel HAT with Bloom filter");
+        performanceTest(PersistentBTree<int>(1000,1999),"persistent B-tree");
+        performanceTest(AdaptiveSet<int,BTree<int>>(16,65536),"B-tree with adaptive chunk size");
+        performanceTest(LearnedIndexSet<int>(),"learned index");
         performanceTest(std::set<int>(),"std::set");
+        stringPerformanceTest(BTree<std::string>(64,127),"B-tree of strings");
+        stringPerformanceTest(StringBTree(64,127),"B-tree of strings with prefix compression");
+        std::cout<<"----"<<std::endl;
+        std::cout<<"churn"<<"\t"<<"moved values per operation"<<"\t"<<"time(us)"<<std::endl;
+        churnTest(BTree<CountingInt>(16,31),"B-tree");
+        churnTest(BTree<CountingInt>(16,31,8),"B-tree with underflow slack");
+        churnTest(BTree<CountingInt>(16,31,BTree<CountingInt>::deferredRebalancing),"B-tree with deferred rebalancing");
+        churnTest(MultilevelHat<CountingInt>(16,31),"multilevel HAT");
+        churnTest(MultilevelHat<CountingInt>(16,31,8),"multilevel HAT with underflow slack");
+        churnTest(MultilevelHatWithCachedSmallest<CountingInt>(16,31),"multilevel HAT with cached smallest element");
+        churnTest(
+            MultilevelHatWithCachedSmallest<CountingInt>(16,31,8),
+            "multilevel HAT with cached smallest element and underflow slack");
+        std::cout<<"----"<<std::endl;
+        std::cout<<"insertion latency(us)"<<"\t"<<"p50"<<"\t"<<"p99"<<"\t"<<"p99.9"<<"\t"<<"p99.99"<<"\t"<<"max"<<std::endl;
+        latencyTest(HatSet<int>(10000,19999),"HAT");
+        latencyTest(HatSet<int>(10000,19999,256),"HAT with incremental splits");
+        latencyTest(BTree<int>(1000,1999),"B-tree");
+        latencyTest(MultilevelHatWithCachedSmallest<int>(1000,1999),"multilevel HAT with cached smallest element");
+        latencyTest(std::set<int>(),"std::set");
+        std::cout<<"----"<<std::endl;
+        std::cout<<"statistics";
+        for(auto counter:{Counter::split,Counter::merge,Counter::depthIncrease,Counter::depthDecrease})
+            std::cout<<"\t"<<getCounterName(counter);
+        std::cout<<"\t"<<"nodes per lookup"<<"\t"<<"moved values per insert"<<"\t"<<"leaves by fill(tenths)"<<std::endl;
+        statisticsTest(HatSet<int,std::allocator<int>,CountingStatistics>(10000,19999),"HAT");
+        statisticsTest(HatSet<int,std::allocator<int>,CountingStatistics>(10000,19999,256),"HAT with incremental splits");
+        statisticsTest(BTree<int,std::allocator<int>,CountingStatistics>(1000,1999),"B-tree");
+        statisticsTest(MultilevelHat<int,std::allocator<int>,CountingStatistics>(1000,1999),"multilevel HAT");
+        statisticsTest(
+            MultilevelHatWithCachedSmallest<int,std::allocator<int>,CountingStatistics>(1000,1999),
+            "multilevel HAT with cached smallest element");
+        std::cout<<"----"<<std::endl;
+        std::cout<<"expiration"<<"\t"<<"time per expired value(us)"<<std::endl;
+        expirationTest(BTree<int>(1000,1999),"B-tree, range erase",true);
+        expirationTest(BTree<int>(1000,1999),"B-tree, single erases",false);
+        expirationTest(HatSet<int>(10000,19999),"HAT, range erase",true);
+        expirationTest(HatSet<int>(10000,19999),"HAT, single erases",false);
+        expirationTest(
+            MultilevelHatWithCachedSmallest<int>(1000,1999),
+            "multilevel HAT with cached smallest element, range erase",
+            true);
+        expirationTest(
+            MultilevelHatWithCachedSmallest<int>(1000,1999),
+            "multilevel HAT with cached smallest element, single erases",
+            false);
+        expirationTest(std::set<int>(),"std::set, range erase",true);
+        std::cout<<"----"<<std::endl;
+        std::cout<<"after erasing 95%"<<"\t"<<"searching(us)"<<"\t"<<"compacting(ms)"<<"\t"<<"searching after compacting(us)"<<std::endl;
+        compactionTest(HatSet<int>(10000,19999),"HAT");
+        compactionTest(HatSet<int>(0,19999),"HAT without merging");
+        compactionTest(BTree<int>(1000,1999,BTree<int>::deferredRebalancing),"B-tree with deferred rebalancing");
+        std::cout<<"incremental compaction"<<"\t"<<"steps"<<"\t"<<"longest step(us)"<<std::endl;
+        incrementalCompactionTest(HatSet<int>(0,19999),"HAT without merging, 10000 values per step",10000);
+        incrementalCompactionTest(HatSet<int>(0,19999),"HAT without merging, 100000 values per step",100000);
+        std::cout<<"----"<<std::endl;
+        std::cout<<"priority queue(us)"<<"\t"<<"filling"<<"\t"<<"replacing smallest"<<"\t"<<"draining"<<std::endl;
+        priorityQueueTest(HatSet<int>(10000,19999),"HAT");
+        priorityQueueTest(BTree<int>(1000,1999),"B-tree");
+        priorityQueueTest(MultilevelHat<int>(1000,1999),"multilevel HAT");
+        priorityQueueTest(MultilevelHatWithCachedSmallest<int>(1000,1999),"multilevel HAT with cached smallest element");
+        priorityQueueTest(MinQueue(),"std::priority_queue");
+        priorityQueueTest(std::set<int>(),"std::set");
+        calibrationTest<BTree<int>>("B-tree",0.9);
+        calibrationTest<BTree<int>>("B-tree",0.1);
+        calibrationTest<MultilevelHatWithCachedSmallest<int>>("multilevel HAT with cached smallest element",0.9);
+        using ShardedBTree=ShardedSet<int,BTree<int>>;
+        concurrentPerformanceTest(ShardedBTree(BTree<int>(1000,1999),16,ShardedBTree::Partitioning::hash),"sharded B-tree (hash)");
+        concurrentPerformanceTest(ShardedBTree(BTree<int>(1000,1999),16,ShardedBTree::Partitioning::range),"sharded B-tree (range)");
+        using ShardedHat=ShardedSet<int,MultilevelHatWithCachedSmallest<int>>;
+        concurrentPerformanceTest(
+            ShardedHat(MultilevelHatWithCachedSmallest<int>(1000,1999),16,ShardedHat::Partitioning::range),
+            "sharded multilevel HAT with cached smallest element (range)");
     }
     catch(const std::logic_error &e)
     {